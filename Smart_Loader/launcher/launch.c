@@ -21,8 +21,22 @@ char* isValidElf(Elf32_Ehdr* ehdr) {
 }
 
 int main(int argc, char** argv) {
-    if (argc != 4 || argv[0] == NULL || argv[1] == NULL || argv[2] == NULL || argv[3] == NULL) {
-        printf("Usage: %s <ELF Executable> <Page Replacement Policy ({FIFO}, {RANDOM})> <Max Number of Pages>\n", argv[0]);
+    if (argc < 4 || argv[0] == NULL || argv[1] == NULL || argv[2] == NULL || argv[3] == NULL) {
+        printf("Usage: %s <ELF Executable> <Page Replacement Policy ({FIFO}, {RANDOM}, {CLOCK}, {LRU}, {LFU}, {ARC})> <Max Number of Pages> [Options]\n", argv[0]);
+        printf("Options:\n");
+        printf("  --trace <File>         Record every page fault to a binary trace file\n");
+        printf("  --trace-size <MiB>     Space preallocated for the trace (default 64)\n");
+        printf("  --mrc                  Print the LRU miss-ratio curve for every number of pages\n");
+        printf("  --fault-around <N>     Map up to N following pages of the segment with each faulting page\n");
+        printf("  --prefetch             Load the pages predicted by a stride/Markov prefetcher\n");
+        printf("  --zswap <KiB>          Keep evicted pages compressed in RAM, within this budget, before swap.img\n");
+        printf("  --swap-backend <Name>  How swap.img is accessed: thread (default, background writeback), sync, uring or mmap\n");
+        printf("  --swap-msync           With the mmap backend, start writing back each stored page with msync\n");
+        printf("  --swap-dontneed        With the mmap backend, drop swap pages from the loader's mapping after use\n");
+        printf("  --userfaultfd          Resolve missing pages from a userfaultfd thread instead of SIGSEGV\n");
+        printf("  --adaptive <F>,<C>[,<GrowUs>,<ShrinkUs>]  Adapt the budget between F and C pages to the page fault frequency\n");
+        printf("  --budget-log <File>    With --adaptive, write every budget decision to this file\n");
+        printf("  --warm-start <File>    Prefault the resident set saved in this profile by the last run, then save this run's\n");
         exit(1);
     }
 
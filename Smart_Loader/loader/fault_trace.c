@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fault_trace.h"
+
+/*
+ * The trace file is sized and mapped once when tracing starts, so recording a fault only encodes a few bytes into
+ * shared memory: no syscall is made on the fault path (clock_gettime is served by the vDSO). The header is written
+ * and the file truncated to its used size when tracing finishes.
+ */
+
+/* Private Global Variables for Tracing */
+static int TRACE_FD = -1;
+static unsigned char *TRACE_BUFFER = NULL;     /* Mapping of the whole trace file, header included */
+static size_t TRACE_CAPACITY = 0;              /* Size of the mapping */
+static size_t TRACE_USED = 0;                  /* Bytes of the mapping written so far, header included */
+
+static uint64_t NUMBER_OF_RECORDS = 0;
+static uint32_t DROPPED_RECORDS = 0;
+static uint64_t PREVIOUS_PAGE = 0;
+static uint64_t PREVIOUS_TIME_NS = 0;
+
+
+static uint64_t monotonic_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static unsigned char *write_varint(unsigned char *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+
+void start_fault_trace(const char *path, long capacity_bytes, long max_pages, const char *policy) {
+    if ((size_t)capacity_bytes < sizeof(FaultTraceHeader) + TRACE_MAX_RECORD_SIZE) {
+        printf("Trace capacity too small\n");
+        exit(2);
+    }
+
+    TRACE_FD = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (TRACE_FD == -1) {perror("Failed to open trace file"); exit(2);}
+
+    if (ftruncate(TRACE_FD, capacity_bytes) == -1) {perror("Failed to size trace file"); exit(2);}
+
+    TRACE_BUFFER = (unsigned char *) mmap(NULL, capacity_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, TRACE_FD, 0);
+    if (TRACE_BUFFER == MAP_FAILED) {perror("Failed to map trace file"); exit(2);}
+
+    TRACE_CAPACITY = capacity_bytes;
+    TRACE_USED = sizeof(FaultTraceHeader);
+
+    FaultTraceHeader *header = (FaultTraceHeader *) TRACE_BUFFER;
+    memset(header, 0, sizeof(FaultTraceHeader));
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->page_size = 4096;
+    header->max_pages = (uint32_t)max_pages;
+    strncpy(header->policy, policy, sizeof(header->policy) - 1);
+    header->start_time_ns = monotonic_time_ns();
+
+    PREVIOUS_TIME_NS = header->start_time_ns;
+}
+
+
+/* Called from the SIGSEGV handler, must stay async signal safe */
+void record_fault(unsigned long page_number, int seg_idx, int source) {
+    if (!TRACE_BUFFER) return;
+
+    if (TRACE_CAPACITY - TRACE_USED < TRACE_MAX_RECORD_SIZE) {
+        DROPPED_RECORDS++;
+        return;
+    }
+
+    uint64_t now = monotonic_time_ns();
+    int64_t page_delta = (int64_t)(page_number - PREVIOUS_PAGE);
+
+    unsigned char *out = TRACE_BUFFER + TRACE_USED;
+    if (seg_idx >= 0 && seg_idx < TRACE_SEGMENT_ESCAPE) {
+        *out++ = (unsigned char)(source | (seg_idx << 2));
+    } else {
+        *out++ = (unsigned char)(source | (TRACE_SEGMENT_ESCAPE << 2));
+        out = write_varint(out, (uint64_t)(uint32_t)seg_idx);
+    }
+    out = write_varint(out, ((uint64_t)page_delta << 1) ^ (uint64_t)(page_delta >> 63));
+    out = write_varint(out, now - PREVIOUS_TIME_NS);
+
+    TRACE_USED = out - TRACE_BUFFER;
+    PREVIOUS_PAGE = page_number;
+    PREVIOUS_TIME_NS = now;
+    NUMBER_OF_RECORDS++;
+}
+
+
+void finish_fault_trace() {
+    if (!TRACE_BUFFER) return;
+
+    FaultTraceHeader *header = (FaultTraceHeader *) TRACE_BUFFER;
+    header->number_of_records = NUMBER_OF_RECORDS;
+    header->data_size = TRACE_USED - sizeof(FaultTraceHeader);
+    header->dropped_records = DROPPED_RECORDS;
+
+    if (DROPPED_RECORDS) printf("Fault trace full, %u faults were not recorded\n", DROPPED_RECORDS);
+
+    munmap(TRACE_BUFFER, TRACE_CAPACITY);
+    TRACE_BUFFER = NULL;
+
+    if (ftruncate(TRACE_FD, TRACE_USED) == -1) perror("Failed to truncate trace file");
+    close(TRACE_FD);
+    TRACE_FD = -1;
+}
@@ -0,0 +1,92 @@
+#ifndef FAULT_TRACE_H
+#define FAULT_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Page fault trace file: a FaultTraceHeader followed by data_size bytes of records.
+ *
+ * Every record is a flags byte followed by two varints (7 bits per byte, low bits first, high bit set on all but
+ * the last byte):
+ *   flags   bits 0-1 source of the fault (TRACE_SOURCE_*), bits 2-7 segment index (TRACE_SEGMENT_ESCAPE if it does
+ *           not fit, the index then follows as a varint)
+ *   page    zigzag encoded difference with the page number of the previous record (first record: with 0)
+ *   time    nanoseconds since the previous record (first record: since start_time_ns)
+ *
+ * All header fields are little endian and laid out so the header is the same on 32 and 64 bit builds.
+ */
+
+#define TRACE_MAGIC             "SLFTRACE"
+#define TRACE_VERSION           1
+
+#define TRACE_SOURCE_ELF        0       /* Page read from the executable */
+#define TRACE_SOURCE_SWAP       1       /* Page restored from swap */
+#define TRACE_SOURCE_ZERO       2       /* Page zero filled (BSS) */
+#define TRACE_SOURCE_REFERENCE  3       /* Soft fault on a resident page, an access sampled for the replacement policy */
+
+#define TRACE_SEGMENT_ESCAPE    63
+
+#define TRACE_MAX_RECORD_SIZE   (1 + 5 + 10 + 10)
+
+typedef struct FaultTraceHeader {
+    char magic[8];
+    uint64_t start_time_ns;         /* CLOCK_MONOTONIC time the trace was started at */
+    uint64_t number_of_records;
+    uint64_t data_size;             /* Bytes of records following the header */
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t max_pages;
+    uint32_t dropped_records;       /* Faults not recorded because the trace buffer was full */
+    char policy[16];
+} FaultTraceHeader;
+
+/* A decoded record */
+typedef struct FaultTraceRecord {
+    uint64_t page;
+    uint64_t time_ns;               /* Absolute CLOCK_MONOTONIC time */
+    int source;
+    int seg_idx;
+} FaultTraceRecord;
+
+
+/* Loader side, recording is off until start_fault_trace succeeds */
+void start_fault_trace(const char *path, long capacity_bytes, long max_pages, const char *policy);
+void record_fault(unsigned long page_number, int seg_idx, int source);
+void finish_fault_trace();
+
+
+/* Decodes the record at *pos (previous holds the last decoded record, zeroed with time_ns = start_time_ns before
+ * the first one), advancing *pos. Returns 0 on a truncated record. */
+static inline int decode_fault_record(const unsigned char *data, size_t size, size_t *pos, FaultTraceRecord *previous) {
+    uint64_t values[3] = {0, 0, 0};
+    size_t p = *pos;
+    if (p >= size) return 0;
+
+    int flags = data[p++];
+    int number_of_values = ((flags >> 2) == TRACE_SEGMENT_ESCAPE) ? 3 : 2;
+
+    for (int v = 0; v < number_of_values; v++) {
+        int shift = 0;
+        while (1) {
+            if (p >= size || shift > 63) return 0;
+            unsigned char byte = data[p++];
+            values[v] |= (uint64_t)(byte & 0x7f) << shift;
+            shift += 7;
+            if (!(byte & 0x80)) break;
+        }
+    }
+
+    int first = (number_of_values == 3) ? 1 : 0;
+    uint64_t zigzag = values[first];
+    int64_t page_delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+
+    previous->source = flags & 0x3;
+    previous->seg_idx = (number_of_values == 3) ? (int)values[0] : (flags >> 2);
+    previous->page += (uint64_t)page_delta;
+    previous->time_ns += values[first + 1];
+    *pos = p;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "frame_budget.h"
+
+#define PFF_WINDOW             16      /* Page faults whose intervals are averaged */
+#define PFF_EVALUATION_STEP    4       /* Page faults between two decisions */
+#define BUDGET_LOG_CAPACITY    65536   /* Decisions kept, later ones are counted as dropped */
+
+typedef struct BudgetLogEntry {
+    long long time_ns;                  /* Since init_frame_budget */
+    long page_faults;
+    long long mean_interval_ns;
+    long budget;
+    long resident_pages;
+} BudgetLogEntry;
+
+/* Private Global Variables for the Frame Budget */
+static long FLOOR = 0;
+static long CEILING = 0;
+static long BUDGET = 0;
+static long long GROW_INTERVAL_NS = 0;
+static long long SHRINK_INTERVAL_NS = 0;
+
+static struct timespec START_TIME;
+static long long HANDLER_ENTERED_NS = 0;
+static long long HANDLER_LEFT_NS = 0;
+static long long GUEST_NS_SINCE_FAULT = 0;     /* Guest run time since the last page fault */
+
+static long long WINDOW[PFF_WINDOW];           /* Guest run time before each of the last page faults */
+static long long WINDOW_SUM_NS = 0;
+static long PAGE_FAULTS = 0;
+
+static long MIN_BUDGET = 0;
+static long MAX_BUDGET = 0;
+static long GROWTHS = 0;
+static long SHRINKS = 0;
+
+static const char *LOG_PATH = NULL;
+static BudgetLogEntry *BUDGET_LOG = NULL;
+static long NUMBER_OF_LOG_ENTRIES = 0;
+static long DROPPED_LOG_ENTRIES = 0;
+
+
+static long long elapsed_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)(now.tv_sec - START_TIME.tv_sec) * 1000000000LL + (now.tv_nsec - START_TIME.tv_nsec);
+}
+
+
+long init_frame_budget(long floor, long ceiling, long initial_budget, long grow_interval_us, long shrink_interval_us,
+                       const char *log_path) {
+    FLOOR = floor;
+    CEILING = ceiling;
+    BUDGET = initial_budget < floor ? floor : (initial_budget > ceiling ? ceiling : initial_budget);
+    MIN_BUDGET = MAX_BUDGET = BUDGET;
+    GROW_INTERVAL_NS = grow_interval_us * 1000LL;
+    SHRINK_INTERVAL_NS = shrink_interval_us * 1000LL;
+
+    LOG_PATH = log_path;
+    if (LOG_PATH) {
+        BUDGET_LOG = (BudgetLogEntry *) malloc(BUDGET_LOG_CAPACITY * sizeof(BudgetLogEntry));
+        if (!BUDGET_LOG) {printf("Memory Allocation for budget log failed\n"); exit(2);}
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &START_TIME);
+    return BUDGET;
+}
+
+
+void frame_budget_enter_handler() {
+    HANDLER_ENTERED_NS = elapsed_ns();
+    GUEST_NS_SINCE_FAULT += HANDLER_ENTERED_NS - HANDLER_LEFT_NS;
+}
+
+
+static void log_decision(long long mean_interval_ns, long resident_pages) {
+    if (!BUDGET_LOG) return;
+    if (NUMBER_OF_LOG_ENTRIES == BUDGET_LOG_CAPACITY) {
+        DROPPED_LOG_ENTRIES++;
+        return;
+    }
+
+    BudgetLogEntry *entry = &BUDGET_LOG[NUMBER_OF_LOG_ENTRIES++];
+    entry->time_ns = HANDLER_ENTERED_NS;
+    entry->page_faults = PAGE_FAULTS;
+    entry->mean_interval_ns = mean_interval_ns;
+    entry->budget = BUDGET;
+    entry->resident_pages = resident_pages;
+}
+
+
+/* Called from the fault handlers, only touches preallocated memory */
+long frame_budget_leave_handler(int is_fault, long resident_pages) {
+    if (is_fault) {
+        WINDOW_SUM_NS += GUEST_NS_SINCE_FAULT - WINDOW[PAGE_FAULTS % PFF_WINDOW];
+        WINDOW[PAGE_FAULTS % PFF_WINDOW] = GUEST_NS_SINCE_FAULT;
+        GUEST_NS_SINCE_FAULT = 0;
+        PAGE_FAULTS++;
+
+        if (PAGE_FAULTS >= PFF_WINDOW && PAGE_FAULTS % PFF_EVALUATION_STEP == 0) {
+            long long mean_interval_ns = WINDOW_SUM_NS / PFF_WINDOW;
+
+            if (mean_interval_ns < GROW_INTERVAL_NS && BUDGET < CEILING) {
+                long step = BUDGET / 4 > 1 ? BUDGET / 4 : 1;
+                BUDGET = BUDGET + step < CEILING ? BUDGET + step : CEILING;
+                GROWTHS++;
+            }
+            else if (mean_interval_ns > SHRINK_INTERVAL_NS && BUDGET > FLOOR) {
+                long step = BUDGET / 8 > 1 ? BUDGET / 8 : 1;
+                BUDGET = BUDGET - step > FLOOR ? BUDGET - step : FLOOR;
+                SHRINKS++;
+            }
+
+            if (BUDGET < MIN_BUDGET) MIN_BUDGET = BUDGET;
+            if (BUDGET > MAX_BUDGET) MAX_BUDGET = BUDGET;
+            log_decision(mean_interval_ns, resident_pages);
+        }
+    }
+
+    HANDLER_LEFT_NS = elapsed_ns();
+    return BUDGET;
+}
+
+
+void print_frame_budget_stats() {
+    if (!CEILING) return;
+
+    printf("Adaptive budget (PFF, grow below %lld us, shrink above %lld us between faults): floor %ld, ceiling %ld, "
+        "final %ld (min %ld, max %ld), grown %ld times, shrunk %ld times\n",
+        GROW_INTERVAL_NS / 1000, SHRINK_INTERVAL_NS / 1000, FLOOR, CEILING, BUDGET, MIN_BUDGET, MAX_BUDGET, GROWTHS, SHRINKS);
+}
+
+
+void finish_frame_budget() {
+    if (BUDGET_LOG) {
+        FILE *log = fopen(LOG_PATH, "w");
+        if (!log) perror("Failed to write budget log");
+        else {
+            fprintf(log, "# time_ms page_faults mean_interval_us budget resident_pages (%ld decisions not logged)\n", DROPPED_LOG_ENTRIES);
+            for (long i = 0; i < NUMBER_OF_LOG_ENTRIES; i++) {
+                fprintf(log, "%.3f %ld %.1f %ld %ld\n", BUDGET_LOG[i].time_ns / 1e6, BUDGET_LOG[i].page_faults,
+                    BUDGET_LOG[i].mean_interval_ns / 1e3, BUDGET_LOG[i].budget, BUDGET_LOG[i].resident_pages);
+            }
+            fclose(log);
+        }
+    }
+
+    free(BUDGET_LOG);
+    BUDGET_LOG = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef FRAME_BUDGET_H
+#define FRAME_BUDGET_H
+
+/*
+ * Adaptive frame budget driven by the page fault frequency (PFF). The time the guest runs between two page faults
+ * (time spent in the loader's own handlers excluded) is averaged over a sliding window of the last faults: a short
+ * interval means the process is thrashing and the budget grows by a quarter, a long one means it holds frames it
+ * no longer uses and the budget shrinks by an eighth, always within the floor and the ceiling. Each decision is
+ * kept in a preallocated log, written to a file at exit.
+ */
+
+#define DEFAULT_PFF_GROW_INTERVAL_US    20      /* Mean interval between faults below which the budget grows */
+#define DEFAULT_PFF_SHRINK_INTERVAL_US  200     /* And above which it shrinks */
+
+/* Returns the starting budget, initial_budget clamped to the floor and the ceiling */
+long init_frame_budget(long floor, long ceiling, long initial_budget, long grow_interval_us, long shrink_interval_us,
+                       const char *log_path);
+
+/* Bracket every fault the loader handles (page, reference or write fault), so its time is not counted as the guest's */
+void frame_budget_enter_handler();
+
+/* Returns the budget to apply from now on, is_fault being 1 for a page fault */
+long frame_budget_leave_handler(int is_fault, long resident_pages);
+
+void print_frame_budget_stats();
+
+/* Writes the budget log and releases the estimator */
+void finish_frame_budget();
+
+#endif
@@ -12,24 +12,56 @@
 
 #define PAGE_SIZE_IN_BYTES 4096     /* Cannot be changed due to internal OS workings */
 
+/* Bits of PageDescriptor.flags */
+#define PAGE_RESIDENT      0x1      /* Mapped and counted against max_pages */
+#define PAGE_SWAPPED       0x2      /* swap_slot holds a copy of the page */
+#define PAGE_DIRTY         0x4      /* Resident copy may differ from swap/ELF, must be written back on eviction */
+#define PAGE_REFERENCED    0x8      /* Accessed since the bit was last cleared, a resident page without it is mapped PROT_NONE */
+#define PAGE_PREFETCHED    0x10     /* Mapped by fault-around and not yet known to be used */
+#define PAGE_READAHEAD     0x20     /* Last page of a fault-around window, reaching it maps the next window */
+#define PAGE_PREDICTED     0x40     /* Loaded by the prefetcher and not accessed yet */
+#define PAGE_FILE_MAPPED   0x80     /* Mapped MAP_PRIVATE from the ELF with its segment's protection */
+#define PAGE_ZERO_MAPPED   0x100    /* Untouched BSS mapped read-only over the shared zero page, not resident until written */
+
+#define PAGE_PROTECTION    (PROT_READ | PROT_WRITE | PROT_EXEC)     /* Protection of a resident page being accessed */
+
+/* Per page metadata, one for every page from the first to the last page covered by a PT_LOAD segment */
+typedef struct PageDescriptor {
+    unsigned int flags;
+    int swap_slot;          /* Slot in the swap file, -1 if the page was never swapped out */
+    int seg_idx;            /* Owning segment, -1 for pages in a gap between segments */
+} PageDescriptor;
+
+/* Optional launcher flags, given after the three positional arguments */
+typedef struct LoaderOptions {
+    const char *trace_path;     /* --trace <file>: record every fault to this file */
+    long trace_capacity;        /* --trace-size <MiB>: size preallocated for the trace */
+    int miss_ratio_curve;       /* --mrc: print the LRU miss-ratio curve of the run */
+    long fault_around;          /* --fault-around <Pages>: neighbours mapped with each faulting page */
+    int prefetch;               /* --prefetch: load the pages the stride/Markov prefetcher predicts */
+    long zswap_budget;          /* --zswap <KiB>: byte budget of the compressed swap tier, 0 if disabled */
+    const char *swap_backend;   /* --swap-backend <Name>: how swap.img is accessed (sync, thread, uring, mmap), NULL for the default */
+    int swap_msync;             /* --swap-msync: mmap backend starts writing back each stored page with msync */
+    int swap_dontneed;          /* --swap-dontneed: mmap backend drops each page it touched from the loader's mapping */
+    int userfaultfd;            /* --userfaultfd: resolve missing pages from a userfaultfd thread instead of SIGSEGV */
+    long budget_floor;          /* --adaptive <Floor>,<Ceiling>[,<GrowUs>,<ShrinkUs>]: bounds of the page fault frequency driven budget */
+    long budget_ceiling;        /* 0 if the budget stays at max_pages */
+    long pff_grow_interval_us;  /* Mean guest time between page faults below which the budget grows */
+    long pff_shrink_interval_us;    /* And above which it shrinks */
+    const char *budget_log_path;    /* --budget-log <file>: write every budget decision to this file */
+    const char *warm_start_path;    /* --warm-start <file>: prefault the resident set saved here by the last run, then save this run's */
+} LoaderOptions;
+
+extern LoaderOptions OPTIONS;
 extern Elf32_Phdr *PHDRS_OF_SEGMENTS_TO_LOAD;
 extern int NUMBER_OF_SEGMENTS_TO_LOAD;
+extern unsigned long FIRST_PAGE_NUMBER;
+extern unsigned long NUMBER_OF_PAGES;
 int find_segment_of_fault(void *fault_addr);
+PageDescriptor *get_page_descriptor(void *addr);
+void evict_page(void *page_start_addr);
+void clear_page_reference(void *page_start_addr);
 
 
 void load_and_run_elf(char** exe);
 void loader_cleanup();
-
-
-/* Methods specific to FIFO replacement algo */
-void add_page_fifo(void *page_start_addr);
-void init_fifo(long max_pages);
-void cleanup_fifo();
-long page_evictions_fifo();
-
-
-/* Methods specific to Random replacement algo */
-void add_page_random(void *page_start_addr);
-void init_random(long max_pages);
-void cleanup_random();
-long page_evictions_random();
@@ -0,0 +1,129 @@
+#include "loader.h"
+#include "swap_backend.h"
+
+/*
+ * Memory mapped backend of swap.img. The file is mapped MAP_SHARED into an address range reserved once for the
+ * largest swap file, away from the guest's segments, so swap-out and swap-in are a memcpy to or from the block's
+ * offset in the mapping and the kernel writes the pages back on its own schedule. The file starts small and is
+ * grown with posix_fallocate (fallocate) by doubling, each new part being mapped in place into the reservation.
+ * --swap-msync starts the writeback of every stored page at once, --swap-dontneed drops every page the backend
+ * touched from the loader's mapping, so swap data does not stay resident in the loader.
+ */
+
+#define MMAP_SWAP_INITIAL_BLOCKS   64      /* 256 KiB */
+
+/* Private Global Variables for the Mapped Swap File */
+static int SWAP_FD = -1;
+static unsigned char *RESERVATION = NULL;
+static long MAX_BLOCKS = 0;
+static long MAPPED_BLOCKS = 0;
+
+static long GROWTHS = 0;
+static long MSYNC_CALLS = 0;
+static long MADVISE_CALLS = 0;
+
+
+/* Reserves the address range, retrying above the guest if the kernel picked a range inside its segments */
+static unsigned char *reserve_outside_guest(size_t length) {
+    unsigned long guest_start = FIRST_PAGE_NUMBER * PAGE_SIZE_IN_BYTES;
+    unsigned long guest_end = (FIRST_PAGE_NUMBER + NUMBER_OF_PAGES) * PAGE_SIZE_IN_BYTES;
+    void *hint = NULL;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        void *area = mmap(hint, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (area == MAP_FAILED) return NULL;
+        if ((unsigned long)area + length <= guest_start || (unsigned long)area >= guest_end) return (unsigned char *)area;
+
+        munmap(area, length);
+        hint = (void *)guest_end;
+    }
+    return NULL;
+}
+
+
+static void grow_swap_file(long blocks) {
+    off_t old_size = (off_t)MAPPED_BLOCKS * PAGE_SIZE_IN_BYTES;
+    off_t new_size = (off_t)blocks * PAGE_SIZE_IN_BYTES;
+
+    if (posix_fallocate(SWAP_FD, old_size, new_size - old_size) != 0) {
+        printf("Swap file growth failed\n");
+        exit(1);
+    }
+
+    if (mmap(RESERVATION + old_size, new_size - old_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, SWAP_FD, old_size) == MAP_FAILED) {
+        perror("Swap file mapping failed");
+        exit(1);
+    }
+
+    MAPPED_BLOCKS = blocks;
+    if (old_size) GROWTHS++;
+}
+
+
+static int mmap_swap_init(int fd, int number_of_blocks) {
+    SWAP_FD = fd;
+    MAX_BLOCKS = number_of_blocks;
+
+    RESERVATION = reserve_outside_guest((size_t)MAX_BLOCKS * PAGE_SIZE_IN_BYTES);
+    if (!RESERVATION) return 0;
+
+    grow_swap_file(MAX_BLOCKS < MMAP_SWAP_INITIAL_BLOCKS ? MAX_BLOCKS : MMAP_SWAP_INITIAL_BLOCKS);
+    return 1;
+}
+
+
+static void drop_from_mapping(unsigned char *block_addr) {
+    if (madvise(block_addr, PAGE_SIZE_IN_BYTES, MADV_DONTNEED) == -1) {
+        perror("Swap madvise failed");
+        exit(1);
+    }
+    MADVISE_CALLS++;
+}
+
+
+static void mmap_swap_write_block(int block, const void *page_addr) {
+    if (block >= MAPPED_BLOCKS) {
+        long blocks = 2 * MAPPED_BLOCKS;
+        if (blocks < block + 1) blocks = block + 1;
+        if (blocks > MAX_BLOCKS) blocks = MAX_BLOCKS;
+        grow_swap_file(blocks);
+    }
+
+    unsigned char *block_addr = RESERVATION + (long)block * PAGE_SIZE_IN_BYTES;
+    memcpy(block_addr, page_addr, PAGE_SIZE_IN_BYTES);
+
+    if (OPTIONS.swap_msync) {
+        if (msync(block_addr, PAGE_SIZE_IN_BYTES, MS_ASYNC) == -1) {
+            perror("Swap msync failed");
+            exit(1);
+        }
+        MSYNC_CALLS++;
+    }
+    if (OPTIONS.swap_dontneed) drop_from_mapping(block_addr);
+}
+
+
+static void mmap_swap_read_block(int block, void *page_addr) {
+    unsigned char *block_addr = RESERVATION + (long)block * PAGE_SIZE_IN_BYTES;
+    memcpy(page_addr, block_addr, PAGE_SIZE_IN_BYTES);
+
+    if (OPTIONS.swap_dontneed) drop_from_mapping(block_addr);
+}
+
+
+static void mmap_swap_print_stats() {
+    printf("Mapped swap file: %ld of %ld KiB mapped (grown %ld times), %ld msync calls, %ld madvise calls\n",
+        MAPPED_BLOCKS * PAGE_SIZE_IN_BYTES / 1024, MAX_BLOCKS * PAGE_SIZE_IN_BYTES / 1024, GROWTHS, MSYNC_CALLS, MADVISE_CALLS);
+}
+
+
+static void mmap_swap_cleanup() {
+    if (RESERVATION) munmap(RESERVATION, (size_t)MAX_BLOCKS * PAGE_SIZE_IN_BYTES);
+    RESERVATION = NULL;
+    MAPPED_BLOCKS = 0;
+}
+
+
+const SwapBackend MMAP_SWAP_BACKEND = {
+    "mmap", mmap_swap_init, mmap_swap_write_block, NULL, mmap_swap_read_block, NULL, mmap_swap_print_stats, mmap_swap_cleanup
+};
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prefetcher.h"
+
+#define MARKOV_MAX_CONFIDENCE  3       /* Saturating counter, a successor is predicted from 2 on */
+#define MARKOV_MIN_CONFIDENCE  2
+
+/* Private Global Variables for Prefetching, the Markov tables are indexed like the page descriptor table */
+static unsigned long FIRST_PAGE = 0;
+static unsigned long NUMBER_OF_TRACKED_PAGES = 0;
+
+static long *SUCCESSOR = NULL;              /* Page index that faulted after each page, -1 if none yet */
+static unsigned char *CONFIDENCE = NULL;
+
+static long PREVIOUS_PAGE_IDX = -1;
+static long PREVIOUS_DELTA = 0;             /* Delta between the two faults before the current one, 0 if unknown */
+
+
+void init_prefetcher(unsigned long first_page_number, unsigned long number_of_pages) {
+    FIRST_PAGE = first_page_number;
+    NUMBER_OF_TRACKED_PAGES = number_of_pages;
+
+    SUCCESSOR = (long *) malloc(number_of_pages * sizeof(long));
+    CONFIDENCE = (unsigned char *) calloc(number_of_pages, sizeof(unsigned char));
+    if (!SUCCESSOR || !CONFIDENCE) {printf("Memory Allocation for prefetcher failed\n"); exit(2);}
+
+    for (unsigned long i = 0; i < number_of_pages; i++) SUCCESSOR[i] = -1;
+}
+
+
+/* Replaces a successor only once its confidence has dropped to 0 */
+static void train_markov(long page_idx, long next_idx) {
+    if (SUCCESSOR[page_idx] == next_idx) {
+        if (CONFIDENCE[page_idx] < MARKOV_MAX_CONFIDENCE) CONFIDENCE[page_idx]++;
+    }
+    else if (CONFIDENCE[page_idx] > 0) CONFIDENCE[page_idx]--;
+    else {
+        SUCCESSOR[page_idx] = next_idx;
+        CONFIDENCE[page_idx] = 1;
+    }
+}
+
+
+int predict_after_fault(unsigned long page_number, unsigned long *predictions) {
+    if (!SUCCESSOR || page_number < FIRST_PAGE || page_number - FIRST_PAGE >= NUMBER_OF_TRACKED_PAGES) return 0;
+    long page_idx = (long)(page_number - FIRST_PAGE);
+    int number_of_predictions = 0;
+
+    if (PREVIOUS_PAGE_IDX != -1) {
+        train_markov(PREVIOUS_PAGE_IDX, page_idx);
+
+        /* Stride: the delta to this fault repeats the one before it */
+        long delta = page_idx - PREVIOUS_PAGE_IDX;
+        long target = page_idx + delta;
+        if (delta != 0 && delta == PREVIOUS_DELTA && target >= 0 && target < (long)NUMBER_OF_TRACKED_PAGES) {
+            predictions[number_of_predictions++] = FIRST_PAGE + target;
+        }
+        PREVIOUS_DELTA = delta;
+    }
+    PREVIOUS_PAGE_IDX = page_idx;
+
+    /* Markov: the confident successor of this page, unless the stride predictor already named it */
+    if (CONFIDENCE[page_idx] >= MARKOV_MIN_CONFIDENCE && SUCCESSOR[page_idx] != page_idx) {
+        unsigned long successor = FIRST_PAGE + SUCCESSOR[page_idx];
+        if (number_of_predictions == 0 || predictions[0] != successor) predictions[number_of_predictions++] = successor;
+    }
+
+    return number_of_predictions;
+}
+
+
+void cleanup_prefetcher() {
+    free(SUCCESSOR);
+    free(CONFIDENCE);
+    SUCCESSOR = NULL;
+    CONFIDENCE = NULL;
+}
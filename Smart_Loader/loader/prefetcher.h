@@ -0,0 +1,21 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+/*
+ * Learned fault prefetcher. Two predictors are trained on the stream of faulting pages:
+ *   stride   the previous fault delta is kept, a delta seen twice in a row predicts the next page
+ *   Markov   every page remembers the page that faulted after it, with a saturating confidence counter
+ * Predictions only name pages, the loader decides whether it has a frame to load them into.
+ */
+
+#define MAX_PREDICTIONS 2
+
+void init_prefetcher(unsigned long first_page_number, unsigned long number_of_pages);
+
+/* Trains on a fault of page_number and writes up to MAX_PREDICTIONS predicted pages, most confident first.
+ * Returns the number of predictions. */
+int predict_after_fault(unsigned long page_number, unsigned long *predictions);
+
+void cleanup_prefetcher();
+
+#endif
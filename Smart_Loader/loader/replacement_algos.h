@@ -1,98 +1,286 @@
-#include "loader.h"
-#include "swap_manager.h"
+#ifndef REPLACEMENT_ALGOS_H
+#define REPLACEMENT_ALGOS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
 
 
 /* ================================================================================================================ */
-/*                                             FIFO REPLACEMENT POLICY                                              */
+/*                                           REPLACEMENT POLICY INTERFACE                                           */
 /* ================================================================================================================ */
 
-typedef struct FIFOPage{
-    void *address;
-    struct FIFOPage *next_page;
-} FIFOPage;
+/*
+ * A policy only does the bookkeeping of which pages are resident and which one to give up, pages being identified
+ * by their page number. Mapping, unmapping and swapping stay in the loader core, which asks for a victim whenever
+ * the resident set is at its budget. Policies are instances, so several can run side by side (e.g. in a simulator).
+ */
+
+/* Services a policy may need from whoever runs it, any of them may be NULL */
+typedef struct PolicyHost {
+    void (*clear_reference)(unsigned long page);    /* Arrange for the next access of a resident page to be reported to on_access */
+} PolicyHost;
+
+typedef struct ReplacementPolicy {
+    const char *name;
+    int samples_references;     /* 1 if the host should periodically clear reference bits so on_access gets called */
+
+    void *(*create)(long max_pages, const PolicyHost *host);
+    void (*destroy)(void *state);
+
+    /* A page became resident (max_pages is never exceeded, choose_victim is called first if needed) */
+    void (*on_fault)(void *state, unsigned long page);
+
+    /* A resident page was accessed, NULL if the policy does not track references */
+    void (*on_access)(void *state, unsigned long page);
+
+    /* Removes and returns a resident page to evict so incoming_page can be brought in */
+    unsigned long (*choose_victim)(void *state, unsigned long incoming_page);
+
+    /* Calls callback on every resident page */
+    void (*iterate_resident)(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx);
+
+    /* Prints the policy specific statistics, NULL if there are none */
+    void (*stats)(void *state);
+
+    /* The budget changed to max_pages (never above the one given to create), the host evicts any excess itself through
+     * choose_victim. NULL if the policy keeps no state sized by the budget */
+    void (*resize)(void *state, long max_pages);
+} ReplacementPolicy;
+
+
 
-typedef struct FIFOQueue {
-    FIFOPage *Head;
-    FIFOPage *Tail;
-    long num_of_pages;
-    long max_pages;
-} FIFOQueue;
 
+/* ================================================================================================================ */
+/*                                          SHARED POLICY DATA STRUCTURES                                           */
+/* ================================================================================================================ */
+
+/* Hash map from page number to a node index, open addressing with linear probing and backward shift deletion */
+
+#define PAGE_MAP_EMPTY ((unsigned long)-1)
+
+typedef struct PageMap {
+    unsigned long *pages;
+    int *values;
+    unsigned long mask;     /* Number of buckets - 1, buckets being a power of two at least twice the capacity */
+} PageMap;
 
-FIFOQueue *FIFO_QUEUE; 
-long PAGE_EVICTIONS_FIFO;
+
+void page_map_init(PageMap *map, long capacity) {
+    unsigned long buckets = 1;
+    while (buckets < 2 * (unsigned long)capacity) buckets <<= 1;
+
+    map->mask = buckets - 1;
+    map->pages = (unsigned long *) malloc(buckets * sizeof(unsigned long));
+    map->values = (int *) malloc(buckets * sizeof(int));
+    if (!map->pages || !map->values) {printf("Unable to malloc page map\n"); exit(1);}
+
+    for (unsigned long i = 0; i < buckets; i++) map->pages[i] = PAGE_MAP_EMPTY;
+}
 
 
-void free_page_fifo(FIFOPage *page) {
-    if (page->address) {
-        handle_page_eviction_to_swap(page->address);
-        munmap(page->address, PAGE_SIZE_IN_BYTES);
+void page_map_free(PageMap *map) {
+    free(map->pages);
+    free(map->values);
+}
+
+
+unsigned long page_map_bucket(PageMap *map, unsigned long page) {
+    return (page * 2654435761UL) & map->mask;
+}
+
+
+/* Returns the value stored for the page, -1 if absent */
+int page_map_get(PageMap *map, unsigned long page) {
+    for (unsigned long b = page_map_bucket(map, page); map->pages[b] != PAGE_MAP_EMPTY; b = (b + 1) & map->mask) {
+        if (map->pages[b] == page) return map->values[b];
     }
-    page->next_page = NULL;
-    free(page);
+    return -1;
 }
 
 
-void evict_page_fifo() {
-    if (FIFO_QUEUE->Head == NULL || FIFO_QUEUE->num_of_pages == 0) {printf("FifoQueue already empty or head null, still instructed to evict page"); exit(1);}
+void page_map_put(PageMap *map, unsigned long page, int value) {
+    unsigned long b = page_map_bucket(map, page);
+    while (map->pages[b] != PAGE_MAP_EMPTY && map->pages[b] != page) b = (b + 1) & map->mask;
+    map->pages[b] = page;
+    map->values[b] = value;
+}
 
-    FIFOPage *temp = FIFO_QUEUE->Head;
-    FIFO_QUEUE->Head = temp->next_page;
-    if (FIFO_QUEUE->Head == NULL) FIFO_QUEUE->Tail = NULL;
-    free_page_fifo(temp);
-    FIFO_QUEUE->num_of_pages--;
 
-    PAGE_EVICTIONS_FIFO++;
+void page_map_remove(PageMap *map, unsigned long page) {
+    unsigned long b = page_map_bucket(map, page);
+    while (map->pages[b] != page) {
+        if (map->pages[b] == PAGE_MAP_EMPTY) return;
+        b = (b + 1) & map->mask;
+    }
+
+    /* Shift back the following entries of the cluster whose home bucket is not between the hole and them */
+    unsigned long hole = b;
+    for (unsigned long next = (b + 1) & map->mask; map->pages[next] != PAGE_MAP_EMPTY; next = (next + 1) & map->mask) {
+        unsigned long home = page_map_bucket(map, map->pages[next]);
+        if (((next - home) & map->mask) >= ((next - hole) & map->mask)) {
+            map->pages[hole] = map->pages[next];
+            map->values[hole] = map->values[next];
+            hole = next;
+        }
+    }
+    map->pages[hole] = PAGE_MAP_EMPTY;
 }
 
 
 
-void init_fifo(long max_pages) {
-    FIFO_QUEUE = (FIFOQueue *) malloc(sizeof(FIFOQueue));
-    if (!FIFO_QUEUE) {printf("Unable to malloc fifo queue\n"); exit(1);};
+/* Pool of nodes linked into doubly linked lists by index, the head of a list being its oldest / least recent end */
+
+typedef struct PolicyNode {
+    unsigned long page;
+    int prev;
+    int next;
+    int list;               /* Which list of the policy the node is on */
+    int referenced;         /* CLOCK reference bit */
+    long count;             /* LFU access count, aged */
+    long last_access;       /* LFU tie breaker, older accesses are evicted first */
+    long heap_pos;          /* LFU position in the heap */
+} PolicyNode;
+
+typedef struct NodeList {
+    int head;
+    int tail;
+    long size;
+} NodeList;
+
+typedef struct NodePool {
+    PolicyNode *nodes;
+    int *free_nodes;        /* Stack of unused node indices */
+    long number_of_free_nodes;
+} NodePool;
 
-    FIFO_QUEUE->Head = NULL;
-    FIFO_QUEUE->Tail = NULL;
-    FIFO_QUEUE->num_of_pages = 0;
-    FIFO_QUEUE->max_pages = max_pages;
 
-    PAGE_EVICTIONS_FIFO = 0;
+void node_pool_init(NodePool *pool, long capacity) {
+    pool->nodes = (PolicyNode *) calloc(capacity, sizeof(PolicyNode));
+    pool->free_nodes = (int *) malloc(capacity * sizeof(int));
+    if (!pool->nodes || !pool->free_nodes) {printf("Unable to malloc policy nodes\n"); exit(1);}
+
+    for (long i = 0; i < capacity; i++) pool->free_nodes[i] = (int)(capacity - 1 - i);
+    pool->number_of_free_nodes = capacity;
 }
 
 
-void cleanup_fifo() {
-    /* Iterate over all the pages and unmapping and freeing them */
-    FIFOPage *current = FIFO_QUEUE->Head;
-    while (current != NULL) {
-        FIFOPage *temp = current;
-        current = current->next_page;
-        free_page_fifo(temp);
-    }
+void node_pool_free(NodePool *pool) {
+    free(pool->nodes);
+    free(pool->free_nodes);
+}
+
 
-    if (FIFO_QUEUE) free(FIFO_QUEUE);    /* Free the fifo queue if not null */
+int node_alloc(NodePool *pool, unsigned long page) {
+    if (pool->number_of_free_nodes == 0) {printf("Policy node pool exhausted\n"); exit(1);}
+    int idx = pool->free_nodes[--pool->number_of_free_nodes];
+    memset(&pool->nodes[idx], 0, sizeof(PolicyNode));
+    pool->nodes[idx].page = page;
+    return idx;
 }
 
 
-long page_evictions_fifo() {return PAGE_EVICTIONS_FIFO;}
+void node_release(NodePool *pool, int idx) {
+    pool->free_nodes[pool->number_of_free_nodes++] = idx;
+}
 
 
-void add_page_fifo(void *page_start_addr) {
+void list_init(NodeList *list) {
+    list->head = -1;
+    list->tail = -1;
+    list->size = 0;
+}
 
-    while (FIFO_QUEUE->num_of_pages >= FIFO_QUEUE->max_pages) evict_page_fifo();
 
-    FIFOPage *new_page = (FIFOPage *) malloc(sizeof(FIFOPage));
-    new_page->address = page_start_addr;
-    new_page->next_page = NULL;
-    
-    if (FIFO_QUEUE->Head == NULL && FIFO_QUEUE->Tail == NULL) {
-        FIFO_QUEUE->Head = new_page;
-        FIFO_QUEUE->Tail = new_page;
-    } else {
-        FIFO_QUEUE->Tail->next_page = new_page;
-        FIFO_QUEUE->Tail = new_page;
-    }
+void list_push_back(NodePool *pool, NodeList *list, int list_id, int idx) {
+    PolicyNode *node = &pool->nodes[idx];
+    node->list = list_id;
+    node->prev = list->tail;
+    node->next = -1;
+
+    if (list->tail != -1) pool->nodes[list->tail].next = idx;
+    else list->head = idx;
+    list->tail = idx;
+    list->size++;
+}
+
+
+void list_remove(NodePool *pool, NodeList *list, int idx) {
+    PolicyNode *node = &pool->nodes[idx];
+
+    if (node->prev != -1) pool->nodes[node->prev].next = node->next;
+    else list->head = node->next;
+    if (node->next != -1) pool->nodes[node->next].prev = node->prev;
+    else list->tail = node->prev;
+
+    node->prev = -1;
+    node->next = -1;
+    list->size--;
+}
+
+
+int list_pop_front(NodePool *pool, NodeList *list) {
+    int idx = list->head;
+    if (idx != -1) list_remove(pool, list, idx);
+    return idx;
+}
+
+
+void list_iterate(NodePool *pool, NodeList *list, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    for (int idx = list->head; idx != -1; idx = pool->nodes[idx].next) callback(pool->nodes[idx].page, ctx);
+}
+
+
+
+
+/* ================================================================================================================ */
+/*                                             FIFO REPLACEMENT POLICY                                              */
+/* ================================================================================================================ */
 
-    FIFO_QUEUE->num_of_pages++;
+typedef struct FIFOQueue {
+    NodePool pool;
+    NodeList queue;
+} FIFOQueue;
+
+
+void *fifo_create(long max_pages, const PolicyHost *host) {
+    FIFOQueue *fifo = (FIFOQueue *) malloc(sizeof(FIFOQueue));
+    if (!fifo) {printf("Unable to malloc fifo queue\n"); exit(1);};
+
+    node_pool_init(&fifo->pool, max_pages);
+    list_init(&fifo->queue);
+    return fifo;
+}
+
+
+void fifo_destroy(void *state) {
+    FIFOQueue *fifo = (FIFOQueue *) state;
+    node_pool_free(&fifo->pool);
+    free(fifo);
+}
+
+
+void fifo_on_fault(void *state, unsigned long page) {
+    FIFOQueue *fifo = (FIFOQueue *) state;
+    list_push_back(&fifo->pool, &fifo->queue, 0, node_alloc(&fifo->pool, page));
+}
+
+
+unsigned long fifo_choose_victim(void *state, unsigned long incoming_page) {
+    FIFOQueue *fifo = (FIFOQueue *) state;
+
+    int idx = list_pop_front(&fifo->pool, &fifo->queue);
+    if (idx == -1) {printf("FifoQueue already empty, still instructed to evict page"); exit(1);}
+
+    node_release(&fifo->pool, idx);
+    return fifo->pool.nodes[idx].page;
+}
+
+
+void fifo_iterate_resident(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    FIFOQueue *fifo = (FIFOQueue *) state;
+    list_iterate(&fifo->pool, &fifo->queue, callback, ctx);
 }
 
 
@@ -104,65 +292,576 @@ void add_page_fifo(void *page_start_addr) {
 /* ================================================================================================================ */
 
 typedef struct RandomArray {
-    void **adresses;
-    long max_pages;
-    long alloc_idx;
+    unsigned long *pages;
+    long num_of_pages;
 } RandomArray;
 
 
+void *random_create(long max_pages, const PolicyHost *host) {
+    srand(time(NULL));    /* Initialise seed for random number generator */
+
+    RandomArray *random_array = (RandomArray *) malloc(sizeof(RandomArray));
+    if (!random_array) {printf("Unable to malloc random array of pages\n"); exit(1);};
+
+    random_array->pages = (unsigned long *) malloc(sizeof(unsigned long) * max_pages);
+    if (!random_array->pages) {printf("Unable to malloc random array of pages\n"); exit(1);};
+    random_array->num_of_pages = 0;
+
+    return random_array;
+}
 
-RandomArray* PAGES = NULL;
-long PAGE_EVICTIONS_RANDOM;
 
+void random_destroy(void *state) {
+    RandomArray *random_array = (RandomArray *) state;
+    free(random_array->pages);
+    free(random_array);
+}
+
+
+void random_on_fault(void *state, unsigned long page) {
+    RandomArray *random_array = (RandomArray *) state;
+    random_array->pages[random_array->num_of_pages++] = page;
+}
+
+
+unsigned long random_choose_victim(void *state, unsigned long incoming_page) {
+    RandomArray *random_array = (RandomArray *) state;
+
+    /* The last page fills the hole so the array stays dense */
+    long idx = rand() % random_array->num_of_pages;
+    unsigned long victim = random_array->pages[idx];
+    random_array->pages[idx] = random_array->pages[--random_array->num_of_pages];
+    return victim;
+}
 
 
-void free_page_random(int idx) {
-    if (PAGES->adresses[idx]) {
-        handle_page_eviction_to_swap(PAGES->adresses[idx]);
-        munmap(PAGES->adresses[idx], PAGE_SIZE_IN_BYTES);
+void random_iterate_resident(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    RandomArray *random_array = (RandomArray *) state;
+    for (long i = 0; i < random_array->num_of_pages; i++) callback(random_array->pages[i], ctx);
+}
+
+
+
+
+
+/* ================================================================================================================ */
+/*                                      CLOCK (SECOND CHANCE) REPLACEMENT POLICY                                    */
+/* ================================================================================================================ */
+
+/*
+ * Resident pages sit on a circular array swept by a hand. A page with its referenced bit set gets a second chance:
+ * the bit is cleared and the host is asked to report the page's next access (the loader downgrades it to PROT_NONE).
+ * The first page found without the bit is evicted, approximating LRU without hardware reference bits.
+ */
+
+typedef struct ClockFrames {
+    NodePool pool;
+    PageMap map;            /* Page to node, node index being the frame index on the circle */
+    long max_pages;
+    long hand;
+    const PolicyHost *host;
+} ClockFrames;
+
+
+void *clock_create(long max_pages, const PolicyHost *host) {
+    ClockFrames *clock_frames = (ClockFrames *) malloc(sizeof(ClockFrames));
+    if (!clock_frames) {printf("Unable to malloc clock frames\n"); exit(1);};
+
+    node_pool_init(&clock_frames->pool, max_pages);
+    page_map_init(&clock_frames->map, max_pages);
+    for (long i = 0; i < max_pages; i++) clock_frames->pool.nodes[i].page = PAGE_MAP_EMPTY;
+
+    clock_frames->max_pages = max_pages;
+    clock_frames->hand = 0;
+    clock_frames->host = host;
+    return clock_frames;
+}
+
+
+void clock_destroy(void *state) {
+    ClockFrames *clock_frames = (ClockFrames *) state;
+    node_pool_free(&clock_frames->pool);
+    page_map_free(&clock_frames->map);
+    free(clock_frames);
+}
+
+
+void clock_on_fault(void *state, unsigned long page) {
+    ClockFrames *clock_frames = (ClockFrames *) state;
+
+    /* Takes the frame of the last victim, or the next never used one */
+    int idx = node_alloc(&clock_frames->pool, page);
+    clock_frames->pool.nodes[idx].referenced = 1;
+    page_map_put(&clock_frames->map, page, idx);
+}
+
+
+void clock_on_access(void *state, unsigned long page) {
+    ClockFrames *clock_frames = (ClockFrames *) state;
+    int idx = page_map_get(&clock_frames->map, page);
+    if (idx != -1) clock_frames->pool.nodes[idx].referenced = 1;
+}
+
+
+unsigned long clock_choose_victim(void *state, unsigned long incoming_page) {
+    ClockFrames *clock_frames = (ClockFrames *) state;
+
+    /* Sweep until a page without its referenced bit is found, terminates within one revolution */
+    while (1) {
+        PolicyNode *frame = &clock_frames->pool.nodes[clock_frames->hand];
+        int idx = (int) clock_frames->hand;
+        clock_frames->hand = (clock_frames->hand + 1) % clock_frames->max_pages;
+
+        if (frame->page == PAGE_MAP_EMPTY) continue;
+
+        if (frame->referenced) {
+            frame->referenced = 0;
+            if (clock_frames->host && clock_frames->host->clear_reference) clock_frames->host->clear_reference(frame->page);
+            continue;
+        }
+
+        unsigned long victim = frame->page;
+        page_map_remove(&clock_frames->map, victim);
+        frame->page = PAGE_MAP_EMPTY;
+        node_release(&clock_frames->pool, idx);
+        return victim;
     }
-    PAGES->adresses[idx] = NULL;
 }
 
 
-void init_random(long max_pages) {
-    srand(time(NULL));    /* Initialise seed for random number generator */
+void clock_iterate_resident(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    ClockFrames *clock_frames = (ClockFrames *) state;
+    for (long i = 0; i < clock_frames->max_pages; i++) {
+        if (clock_frames->pool.nodes[i].page != PAGE_MAP_EMPTY) callback(clock_frames->pool.nodes[i].page, ctx);
+    }
+}
+
+
+
+
+
+/* ================================================================================================================ */
+/*                                             LRU REPLACEMENT POLICY                                               */
+/* ================================================================================================================ */
+
+/* Recency list ordered by the last reported access, accesses being sampled by the host through reference bits */
+
+typedef struct LRUList {
+    NodePool pool;
+    PageMap map;
+    NodeList recency;
+} LRUList;
+
+
+void *lru_create(long max_pages, const PolicyHost *host) {
+    LRUList *lru = (LRUList *) malloc(sizeof(LRUList));
+    if (!lru) {printf("Unable to malloc lru list\n"); exit(1);};
+
+    node_pool_init(&lru->pool, max_pages);
+    page_map_init(&lru->map, max_pages);
+    list_init(&lru->recency);
+    return lru;
+}
+
+
+void lru_destroy(void *state) {
+    LRUList *lru = (LRUList *) state;
+    node_pool_free(&lru->pool);
+    page_map_free(&lru->map);
+    free(lru);
+}
+
 
-    PAGES = (RandomArray *) malloc(sizeof(RandomArray));
-    if (!PAGES) {printf("Unable to malloc random array of pages\n"); exit(1);};
+void lru_on_fault(void *state, unsigned long page) {
+    LRUList *lru = (LRUList *) state;
+    int idx = node_alloc(&lru->pool, page);
+    page_map_put(&lru->map, page, idx);
+    list_push_back(&lru->pool, &lru->recency, 0, idx);
+}
 
-    PAGES->adresses = (void **) malloc(sizeof(void *) * (int)max_pages);
-    PAGES->max_pages = max_pages;
-    PAGES->alloc_idx = 0;
 
-    PAGE_EVICTIONS_RANDOM = 0;
+void lru_on_access(void *state, unsigned long page) {
+    LRUList *lru = (LRUList *) state;
+    int idx = page_map_get(&lru->map, page);
+    if (idx == -1) return;
 
-    for (int i = 0; i < PAGES->max_pages; i++) PAGES->adresses[i] = NULL;
+    list_remove(&lru->pool, &lru->recency, idx);
+    list_push_back(&lru->pool, &lru->recency, 0, idx);
 }
 
 
-void cleanup_random() {
-    for (int i = 0; i < PAGES->max_pages; i++) free_page_random(i);
-    if (PAGES->adresses) free(PAGES->adresses);
-    free(PAGES);
+unsigned long lru_choose_victim(void *state, unsigned long incoming_page) {
+    LRUList *lru = (LRUList *) state;
+
+    int idx = list_pop_front(&lru->pool, &lru->recency);
+    if (idx == -1) {printf("LRU list already empty, still instructed to evict page"); exit(1);}
+
+    unsigned long victim = lru->pool.nodes[idx].page;
+    page_map_remove(&lru->map, victim);
+    node_release(&lru->pool, idx);
+    return victim;
 }
 
 
-long page_evictions_random() {return PAGE_EVICTIONS_RANDOM;}
+void lru_iterate_resident(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    LRUList *lru = (LRUList *) state;
+    list_iterate(&lru->pool, &lru->recency, callback, ctx);
+}
+
+
+
 
-void add_page_random(void *page_start_addr) {
-    /* Evict a random page in this case replace it with the new one */
-    if (PAGES->alloc_idx == PAGES->max_pages) {
-        int idx_to_operate = rand() % PAGES->max_pages;
-        free_page_random(idx_to_operate);
-        PAGE_EVICTIONS_RANDOM++;
-        PAGES->adresses[idx_to_operate] = page_start_addr;
-    } 
-    /* When array is not fully filled */
-    else {
-        PAGES->adresses[PAGES->alloc_idx] = page_start_addr;
-        PAGES->alloc_idx++;
+
+/* ================================================================================================================ */
+/*                                             LFU REPLACEMENT POLICY                                               */
+/* ================================================================================================================ */
+
+/*
+ * Binary min-heap on (access count, last access), so the least frequently used page is evicted, oldest first on ties.
+ * Counts are aged dynamically (LFU-DA): a page comes in with the count of the last victim plus one, so pages that
+ * were hot long ago are eventually evicted instead of new pages evicting each other forever.
+ */
+
+typedef struct LFUHeap {
+    NodePool pool;
+    PageMap map;
+    int *heap;              /* Node indices */
+    long size;
+    long ticks;             /* Logical clock for the last access tie breaker */
+    long age;               /* Count of the last evicted page */
+} LFUHeap;
+
+
+int lfu_less(LFUHeap *lfu, int a, int b) {
+    PolicyNode *x = &lfu->pool.nodes[a];
+    PolicyNode *y = &lfu->pool.nodes[b];
+    if (x->count != y->count) return x->count < y->count;
+    return x->last_access < y->last_access;
+}
+
+
+void lfu_swap(LFUHeap *lfu, long i, long j) {
+    int temp = lfu->heap[i];
+    lfu->heap[i] = lfu->heap[j];
+    lfu->heap[j] = temp;
+    lfu->pool.nodes[lfu->heap[i]].heap_pos = i;
+    lfu->pool.nodes[lfu->heap[j]].heap_pos = j;
+}
+
+
+void lfu_sift_up(LFUHeap *lfu, long i) {
+    while (i > 0 && lfu_less(lfu, lfu->heap[i], lfu->heap[(i - 1) / 2])) {
+        lfu_swap(lfu, i, (i - 1) / 2);
+        i = (i - 1) / 2;
     }
 }
 
 
+void lfu_sift_down(LFUHeap *lfu, long i) {
+    while (1) {
+        long smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < lfu->size && lfu_less(lfu, lfu->heap[left], lfu->heap[smallest])) smallest = left;
+        if (right < lfu->size && lfu_less(lfu, lfu->heap[right], lfu->heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        lfu_swap(lfu, i, smallest);
+        i = smallest;
+    }
+}
+
+
+void *lfu_create(long max_pages, const PolicyHost *host) {
+    LFUHeap *lfu = (LFUHeap *) malloc(sizeof(LFUHeap));
+    if (!lfu) {printf("Unable to malloc lfu heap\n"); exit(1);};
+
+    node_pool_init(&lfu->pool, max_pages);
+    page_map_init(&lfu->map, max_pages);
+    lfu->heap = (int *) malloc(max_pages * sizeof(int));
+    if (!lfu->heap) {printf("Unable to malloc lfu heap\n"); exit(1);};
+    lfu->size = 0;
+    lfu->ticks = 0;
+    lfu->age = 0;
+    return lfu;
+}
+
+
+void lfu_destroy(void *state) {
+    LFUHeap *lfu = (LFUHeap *) state;
+    node_pool_free(&lfu->pool);
+    page_map_free(&lfu->map);
+    free(lfu->heap);
+    free(lfu);
+}
+
+
+void lfu_on_fault(void *state, unsigned long page) {
+    LFUHeap *lfu = (LFUHeap *) state;
+    int idx = node_alloc(&lfu->pool, page);
+    page_map_put(&lfu->map, page, idx);
+
+    lfu->pool.nodes[idx].count = lfu->age + 1;
+    lfu->pool.nodes[idx].last_access = ++lfu->ticks;
+    lfu->pool.nodes[idx].heap_pos = lfu->size;
+    lfu->heap[lfu->size++] = idx;
+    lfu_sift_up(lfu, lfu->size - 1);
+}
+
+
+void lfu_on_access(void *state, unsigned long page) {
+    LFUHeap *lfu = (LFUHeap *) state;
+    int idx = page_map_get(&lfu->map, page);
+    if (idx == -1) return;
+
+    lfu->pool.nodes[idx].count++;
+    lfu->pool.nodes[idx].last_access = ++lfu->ticks;
+    lfu_sift_down(lfu, lfu->pool.nodes[idx].heap_pos);
+}
+
+
+unsigned long lfu_choose_victim(void *state, unsigned long incoming_page) {
+    LFUHeap *lfu = (LFUHeap *) state;
+    if (lfu->size == 0) {printf("LFU heap already empty, still instructed to evict page"); exit(1);}
+
+    int idx = lfu->heap[0];
+    lfu_swap(lfu, 0, --lfu->size);
+    lfu_sift_down(lfu, 0);
+
+    unsigned long victim = lfu->pool.nodes[idx].page;
+    lfu->age = lfu->pool.nodes[idx].count;
+    page_map_remove(&lfu->map, victim);
+    node_release(&lfu->pool, idx);
+    return victim;
+}
+
+
+void lfu_iterate_resident(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    LFUHeap *lfu = (LFUHeap *) state;
+    for (long i = 0; i < lfu->size; i++) callback(lfu->pool.nodes[lfu->heap[i]].page, ctx);
+}
+
+
+
+
+
+/* ================================================================================================================ */
+/*                                     ARC (ADAPTIVE REPLACEMENT CACHE) POLICY                                      */
+/* ================================================================================================================ */
+
+/*
+ * Megiddo and Modha's ARC: T1 holds pages seen once recently, T2 pages seen at least twice, B1 and B2 remember
+ * (without data) the pages recently evicted from T1 and T2. A fault on a ghost page moves the target size p of T1
+ * towards the list that would have kept it, so the split between recency and frequency adapts to the workload.
+ */
+
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 2
+#define ARC_B2 3
+
+typedef struct ARCState {
+    NodePool pool;
+    PageMap map;            /* Resident and ghost pages */
+    NodeList lists[4];
+    long c;                 /* Cache size */
+    long p;                 /* Target size of T1 */
+    unsigned long prepared_page;    /* Incoming page choose_victim already adapted p and trimmed the ghosts for */
+    long ghost_hits_b1;
+    long ghost_hits_b2;
+} ARCState;
+
+
+void *arc_create(long max_pages, const PolicyHost *host) {
+    ARCState *arc = (ARCState *) malloc(sizeof(ARCState));
+    if (!arc) {printf("Unable to malloc arc state\n"); exit(1);};
+
+    node_pool_init(&arc->pool, 2 * max_pages + 1);
+    page_map_init(&arc->map, 2 * max_pages + 1);
+    for (int i = 0; i < 4; i++) list_init(&arc->lists[i]);
+
+    arc->c = max_pages;
+    arc->p = 0;
+    arc->prepared_page = PAGE_MAP_EMPTY;
+    arc->ghost_hits_b1 = 0;
+    arc->ghost_hits_b2 = 0;
+    return arc;
+}
+
+
+void arc_destroy(void *state) {
+    ARCState *arc = (ARCState *) state;
+    node_pool_free(&arc->pool);
+    page_map_free(&arc->map);
+    free(arc);
+}
+
+
+/* Forgets the least recent page of a ghost list */
+void arc_drop_ghost(ARCState *arc, int list_id) {
+    int idx = list_pop_front(&arc->pool, &arc->lists[list_id]);
+    if (idx == -1) return;
+    page_map_remove(&arc->map, arc->pool.nodes[idx].page);
+    node_release(&arc->pool, idx);
+}
+
+
+/* Moves p towards the list of the ghost page being faulted in */
+void arc_adapt(ARCState *arc, int ghost_list) {
+    long b1 = arc->lists[ARC_B1].size, b2 = arc->lists[ARC_B2].size;
+
+    if (ghost_list == ARC_B1) {
+        long delta = (b1 > 0 && b2 / b1 > 1) ? b2 / b1 : 1;
+        arc->p = (arc->p + delta < arc->c) ? arc->p + delta : arc->c;
+        arc->ghost_hits_b1++;
+    } else {
+        long delta = (b2 > 0 && b1 / b2 > 1) ? b1 / b2 : 1;
+        arc->p = (arc->p - delta > 0) ? arc->p - delta : 0;
+        arc->ghost_hits_b2++;
+    }
+}
+
+
+/* ARC's REPLACE: demotes the LRU page of T1 or T2 to its ghost list and returns it */
+unsigned long arc_replace(ARCState *arc, int incoming_in_b2) {
+    long t1 = arc->lists[ARC_T1].size;
+    int from = ARC_T2, to = ARC_B2;
+
+    if (t1 >= 1 && ((incoming_in_b2 && t1 == arc->p) || t1 > arc->p || arc->lists[ARC_T2].size == 0)) {
+        from = ARC_T1;
+        to = ARC_B1;
+    }
+
+    int idx = list_pop_front(&arc->pool, &arc->lists[from]);
+    if (idx == -1) {printf("ARC lists already empty, still instructed to evict page"); exit(1);}
+    list_push_back(&arc->pool, &arc->lists[to], to, idx);
+    return arc->pool.nodes[idx].page;
+}
+
+
+unsigned long arc_choose_victim(void *state, unsigned long incoming_page) {
+    ARCState *arc = (ARCState *) state;
+    arc->prepared_page = incoming_page;
+
+    int idx = page_map_get(&arc->map, incoming_page);
+    if (idx != -1) {
+        int ghost_list = arc->pool.nodes[idx].list;
+        arc_adapt(arc, ghost_list);
+        return arc_replace(arc, ghost_list == ARC_B2);
+    }
+
+    long t1 = arc->lists[ARC_T1].size, b1 = arc->lists[ARC_B1].size;
+    long total = t1 + b1 + arc->lists[ARC_T2].size + arc->lists[ARC_B2].size;
+
+    if (t1 + b1 >= arc->c) {
+        if (t1 < arc->c) {
+            arc_drop_ghost(arc, ARC_B1);
+            return arc_replace(arc, 0);
+        }
+
+        /* T1 alone fills the cache, its LRU page is dropped without leaving a ghost */
+        idx = list_pop_front(&arc->pool, &arc->lists[ARC_T1]);
+        unsigned long victim = arc->pool.nodes[idx].page;
+        page_map_remove(&arc->map, victim);
+        node_release(&arc->pool, idx);
+        return victim;
+    }
+
+    if (total >= 2 * arc->c) arc_drop_ghost(arc, ARC_B2);
+    return arc_replace(arc, 0);
+}
+
+
+void arc_on_fault(void *state, unsigned long page) {
+    ARCState *arc = (ARCState *) state;
+    int prepared = (arc->prepared_page == page);
+    arc->prepared_page = PAGE_MAP_EMPTY;
+
+    int idx = page_map_get(&arc->map, page);
+    if (idx != -1) {
+        /* Ghost hit, p was not adapted yet if no eviction was needed */
+        int ghost_list = arc->pool.nodes[idx].list;
+        if (!prepared) arc_adapt(arc, ghost_list);
+        list_remove(&arc->pool, &arc->lists[ghost_list], idx);
+        list_push_back(&arc->pool, &arc->lists[ARC_T2], ARC_T2, idx);
+        return;
+    }
+
+    /* Keep the ghost lists within their bounds when no eviction made room for the page */
+    if (!prepared) {
+        long t1 = arc->lists[ARC_T1].size, b1 = arc->lists[ARC_B1].size;
+        long total = t1 + b1 + arc->lists[ARC_T2].size + arc->lists[ARC_B2].size;
+
+        if (t1 + b1 >= arc->c && b1 > 0) arc_drop_ghost(arc, ARC_B1);
+        else if (total >= 2 * arc->c) arc_drop_ghost(arc, arc->lists[ARC_B2].size > 0 ? ARC_B2 : ARC_B1);
+    }
+
+    idx = node_alloc(&arc->pool, page);
+    page_map_put(&arc->map, page, idx);
+    list_push_back(&arc->pool, &arc->lists[ARC_T1], ARC_T1, idx);
+}
+
+
+void arc_on_access(void *state, unsigned long page) {
+    ARCState *arc = (ARCState *) state;
+    int idx = page_map_get(&arc->map, page);
+    if (idx == -1) return;
+
+    int list_id = arc->pool.nodes[idx].list;
+    if (list_id != ARC_T1 && list_id != ARC_T2) return;
+
+    list_remove(&arc->pool, &arc->lists[list_id], idx);
+    list_push_back(&arc->pool, &arc->lists[ARC_T2], ARC_T2, idx);
+}
+
+
+void arc_iterate_resident(void *state, void (*callback)(unsigned long page, void *ctx), void *ctx) {
+    ARCState *arc = (ARCState *) state;
+    list_iterate(&arc->pool, &arc->lists[ARC_T1], callback, ctx);
+    list_iterate(&arc->pool, &arc->lists[ARC_T2], callback, ctx);
+}
+
+
+void arc_stats(void *state) {
+    ARCState *arc = (ARCState *) state;
+    printf("ARC target T1 size (p): %ld of %ld\n", arc->p, arc->c);
+    printf("ARC lists: T1 %ld, T2 %ld, B1 %ld, B2 %ld\n",
+        arc->lists[ARC_T1].size, arc->lists[ARC_T2].size, arc->lists[ARC_B1].size, arc->lists[ARC_B2].size);
+    printf("ARC ghost hits: B1 %ld, B2 %ld\n", arc->ghost_hits_b1, arc->ghost_hits_b2);
+}
+
+
+/* The ghost lists shrink back to 2c one per fault, their pool was sized for the largest budget at create */
+void arc_resize(void *state, long max_pages) {
+    ARCState *arc = (ARCState *) state;
+    arc->c = max_pages;
+    if (arc->p > arc->c) arc->p = arc->c;
+}
+
+
+
+
+
+/* ================================================================================================================ */
+/*                                                POLICY REGISTRY                                                   */
+/* ================================================================================================================ */
+
+/* New policies only need an entry here, the first one being the default */
+const ReplacementPolicy REPLACEMENT_POLICIES[] = {
+    {"FIFO", 0, fifo_create, fifo_destroy, fifo_on_fault, NULL, fifo_choose_victim, fifo_iterate_resident, NULL, NULL},
+    {"RANDOM", 0, random_create, random_destroy, random_on_fault, NULL, random_choose_victim, random_iterate_resident, NULL, NULL},
+    {"CLOCK", 0, clock_create, clock_destroy, clock_on_fault, clock_on_access, clock_choose_victim, clock_iterate_resident, NULL, NULL},
+    {"LRU", 1, lru_create, lru_destroy, lru_on_fault, lru_on_access, lru_choose_victim, lru_iterate_resident, NULL, NULL},
+    {"LFU", 1, lfu_create, lfu_destroy, lfu_on_fault, lfu_on_access, lfu_choose_victim, lfu_iterate_resident, NULL, NULL},
+    {"ARC", 1, arc_create, arc_destroy, arc_on_fault, arc_on_access, arc_choose_victim, arc_iterate_resident, arc_stats, arc_resize},
+};
+
+#define NUMBER_OF_REPLACEMENT_POLICIES ((int)(sizeof(REPLACEMENT_POLICIES) / sizeof(REPLACEMENT_POLICIES[0])))
+
+
+/* Returns the policy with this name, NULL if there is none */
+const ReplacementPolicy *find_replacement_policy(const char *name) {
+    for (int i = 0; i < NUMBER_OF_REPLACEMENT_POLICIES; i++) {
+        if (strcmp(REPLACEMENT_POLICIES[i].name, name) == 0) return &REPLACEMENT_POLICIES[i];
+    }
+    return NULL;
+}
+
+#endif
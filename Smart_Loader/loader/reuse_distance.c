@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reuse_distance.h"
+
+/*
+ * Reference times are slots 1..CAPACITY of the Fenwick tree. When the slots run out the live ones (at most one per
+ * page) are renumbered in order, so with twice as many slots as pages a compaction happens at most every
+ * number_of_pages references and everything stays preallocated, as required inside the SIGSEGV handler.
+ */
+
+/* Private Global Variables for Reuse Distance */
+static unsigned long FIRST_PAGE = 0;
+static unsigned long NUMBER_OF_TRACKED_PAGES = 0;
+
+static long *TREE = NULL;               /* Fenwick tree over slots 1..CAPACITY */
+static long *SLOT_PAGE = NULL;          /* Page index whose latest reference is at the slot, -1 if none */
+static long *LAST_SLOT = NULL;          /* Slot of the latest reference to each page, 0 if never referenced */
+static long CAPACITY = 0;
+static long NEXT_SLOT = 1;
+
+static long *HISTOGRAM = NULL;          /* HISTOGRAM[d]: references at stack distance d, 1 <= d <= number of pages */
+static long COLD_MISSES = 0;
+static long TOTAL_REFERENCES = 0;
+
+
+static void tree_add(long slot, long value) {
+    for (; slot <= CAPACITY; slot += slot & -slot) TREE[slot] += value;
+}
+
+
+static long tree_prefix_sum(long slot) {
+    long sum = 0;
+    for (; slot > 0; slot -= slot & -slot) sum += TREE[slot];
+    return sum;
+}
+
+
+/* Renumbers the live slots 1..n keeping their order, and rebuilds the tree in linear time */
+static void compact_slots() {
+    long live = 0;
+    for (long slot = 1; slot < NEXT_SLOT; slot++) {
+        if (SLOT_PAGE[slot] == -1) continue;
+        long page_idx = SLOT_PAGE[slot];
+        SLOT_PAGE[slot] = -1;
+        SLOT_PAGE[++live] = page_idx;
+        LAST_SLOT[page_idx] = live;
+    }
+    NEXT_SLOT = live + 1;
+
+    memset(TREE, 0, (CAPACITY + 1) * sizeof(long));
+    for (long slot = 1; slot <= CAPACITY; slot++) {
+        if (slot < NEXT_SLOT) TREE[slot] += 1;
+        long parent = slot + (slot & -slot);
+        if (parent <= CAPACITY) TREE[parent] += TREE[slot];
+    }
+}
+
+
+void init_reuse_distance(unsigned long first_page_number, unsigned long number_of_pages) {
+    FIRST_PAGE = first_page_number;
+    NUMBER_OF_TRACKED_PAGES = number_of_pages;
+    CAPACITY = 2 * number_of_pages + 2;
+
+    TREE = (long *) calloc(CAPACITY + 1, sizeof(long));
+    SLOT_PAGE = (long *) malloc((CAPACITY + 1) * sizeof(long));
+    LAST_SLOT = (long *) calloc(number_of_pages, sizeof(long));
+    HISTOGRAM = (long *) calloc(number_of_pages + 1, sizeof(long));
+    if (!TREE || !SLOT_PAGE || !LAST_SLOT || !HISTOGRAM) {printf("Memory Allocation for reuse distance failed\n"); exit(2);}
+
+    for (long slot = 0; slot <= CAPACITY; slot++) SLOT_PAGE[slot] = -1;
+}
+
+
+/* Called from the SIGSEGV handler for every observed reference, must stay async signal safe */
+void record_reference(unsigned long page_number) {
+    if (!TREE || page_number < FIRST_PAGE || page_number - FIRST_PAGE >= NUMBER_OF_TRACKED_PAGES) return;
+    long page_idx = (long)(page_number - FIRST_PAGE);
+
+    if (NEXT_SLOT > CAPACITY) compact_slots();
+    TOTAL_REFERENCES++;
+
+    long last = LAST_SLOT[page_idx];
+    if (last) {
+        /* Pages referenced after the last reference, plus the page itself */
+        long distance = tree_prefix_sum(NEXT_SLOT - 1) - tree_prefix_sum(last) + 1;
+        HISTOGRAM[distance]++;
+        tree_add(last, -1);
+        SLOT_PAGE[last] = -1;
+    }
+    else COLD_MISSES++;
+
+    tree_add(NEXT_SLOT, 1);
+    SLOT_PAGE[NEXT_SLOT] = page_idx;
+    LAST_SLOT[page_idx] = NEXT_SLOT++;
+}
+
+
+void print_miss_ratio_curve() {
+    if (!TREE || TOTAL_REFERENCES == 0) return;
+
+    /* Misses with m pages are the cold misses plus the references at a distance above m */
+    long largest_distance = 0;
+    for (unsigned long d = 1; d <= NUMBER_OF_TRACKED_PAGES; d++) {
+        if (HISTOGRAM[d]) largest_distance = d;
+    }
+
+    printf("\n-----------------------------------------------------------------------------\n");
+    printf("------------------------- LRU Miss-Ratio Curve ------------------------------\n");
+    printf("-----------------------------------------------------------------------------\n");
+    printf("Observed references: %ld (cold misses: %ld)\n", TOTAL_REFERENCES, COLD_MISSES);
+    printf("%10s %12s %12s\n", "Max pages", "Misses", "Miss ratio");
+
+    long misses = TOTAL_REFERENCES;
+    for (long m = 1; m <= largest_distance + 1 && m <= (long)NUMBER_OF_TRACKED_PAGES; m++) {
+        misses -= HISTOGRAM[m];
+        printf("%10ld %12ld %12.4f\n", m, misses, (double)misses / (double)TOTAL_REFERENCES);
+    }
+}
+
+
+void cleanup_reuse_distance() {
+    free(TREE);
+    free(SLOT_PAGE);
+    free(LAST_SLOT);
+    free(HISTOGRAM);
+    TREE = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef REUSE_DISTANCE_H
+#define REUSE_DISTANCE_H
+
+/*
+ * Miss-ratio curve from a single run (Mattson's stack algorithm). The LRU stack distance of a reference is the
+ * number of distinct pages referenced since the previous reference to the same page, itself included: LRU with m
+ * pages misses exactly the references whose distance exceeds m, plus the first reference to every page. Distances
+ * are counted with a Fenwick tree over reference times, holding a 1 at the latest reference time of every page.
+ */
+
+void init_reuse_distance(unsigned long first_page_number, unsigned long number_of_pages);
+void record_reference(unsigned long page_number);
+void print_miss_ratio_curve();
+void cleanup_reuse_distance();
+
+#endif
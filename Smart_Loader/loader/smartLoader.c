@@ -1,28 +1,78 @@
+#define _GNU_SOURCE     /* REG_ERR, the page fault error code in the signal context */
+#include <ucontext.h>
+
+#include "loader.h"
 #include "replacement_algos.h"
 #include "swap_manager.h"
+#include "fault_trace.h"
+#include "reuse_distance.h"
+#include "prefetcher.h"
+#include "zswap.h"
+#include "userfault.h"
+#include "frame_budget.h"
+#include "warm_start.h"
 
 
 /* ============================================================================================== */
 /*                            Global definitions and variables                                    */
 /* ============================================================================================== */
 
-#define FIFO_REPLACEMENT_MODE 0
-#define RANDOM_REPLACEMENT_MODE 1
-#define UNDEFINED_REPLACEMENT_MODE -1
-
 Elf32_Ehdr *EHDR;
 Elf32_Phdr *PHDR;
 int FD;
 
+#define DEFAULT_TRACE_CAPACITY_MIB 64
+
+LoaderOptions OPTIONS = {NULL, DEFAULT_TRACE_CAPACITY_MIB * 1024 * 1024, 0, 0, 0, 0, NULL, 0, 0, 0, 0, 0, DEFAULT_PFF_GROW_INTERVAL_US, DEFAULT_PFF_SHRINK_INTERVAL_US, NULL, NULL};
+
 Elf32_Phdr *PHDRS_OF_SEGMENTS_TO_LOAD = NULL;
 int *PAGES_ALLOCED_TO_SEGMENT = NULL;
 int NUMBER_OF_SEGMENTS_TO_LOAD = 0;
 
+PageDescriptor *PAGE_TABLE = NULL;              /* Dense descriptors from FIRST_PAGE_NUMBER, indexed by page number */
+PageDescriptor **SEGMENT_PAGE_TABLES = NULL;    /* Each segment's slice of PAGE_TABLE, starting at its first page */
+unsigned long FIRST_PAGE_NUMBER = 0;
+unsigned long NUMBER_OF_PAGES = 0;
+
 int PAGE_FAULTS = 0;
+int SOFT_PAGE_FAULTS = 0;      /* Faults on resident pages downgraded to PROT_NONE for reference tracking */
+int WRITE_FAULTS = 0;          /* First writes to clean pages of writable segments, mapped read-only until then */
+long CLEAN_EVICTIONS = 0;      /* Evicted pages of writable segments that were not written to swap */
 int PAGE_ALLOCATIONS = 0;
+long FILE_MAPPED_PAGES = 0;    /* Allocations mapped straight from the ELF */
+long ZERO_PAGE_MAPPINGS = 0;   /* Read faults on untouched BSS answered with the shared zero page */
+long ZERO_PAGES_COMMITTED = 0; /* Of those, pages given a frame by their first write */
 long TOTAL_INTERNAL_FRAGMENTATION = 0;
 
-int MODE;
+const ReplacementPolicy *POLICY = NULL;       /* Replacement policy chosen by the user */
+void *POLICY_STATE = NULL;
+int POLICY_RECOGNIZED = 1;                    /* 0 if the mode entered was unknown and the default policy is used */
+PolicyHost POLICY_HOST;
+
+long MAX_PAGES = 0;
+long RESIDENT_PAGES = 0;
+long PAGE_EVICTIONS = 0;
+
+/* Fault-around (--fault-around): pages mapped after the faulting one, 0 if disabled */
+long FAULT_AROUND_WINDOW = 0;
+long PREFETCHED_PAGES = 0;
+long PREFETCHED_PAGES_USED = 0;
+long PREFETCHED_PAGES_EVICTED_UNUSED = 0;
+
+/* Stride/Markov prefetcher (--prefetch) */
+long PREDICTED_PAGES = 0;
+long PREDICTED_PAGES_USED = 0;
+long PREDICTED_PAGES_EVICTED_UNUSED = 0;
+
+/* userfaultfd (--userfaultfd): pages are filled here, then installed with UFFDIO_COPY */
+unsigned char USERFAULT_PAGE[PAGE_SIZE_IN_BYTES] __attribute__((aligned(PAGE_SIZE_IN_BYTES)));
+
+/* Warm start (--warm-start): pages of the profile mapped before the entry point */
+long WARM_START_PAGES = 0;
+
+/* Policies sampling references (and --mrc) have every resident page's referenced bit cleared once per this many page faults */
+long REFERENCE_SAMPLING_INTERVAL = 0;
+long FAULTS_SINCE_REFERENCE_SAMPLING = 0;
 
 
 
@@ -31,29 +81,78 @@ int MODE;
 /*                                   Function Declarations                                        */
 /* ============================================================================================== */
 
-/* Replace algo methods */
-void (*ADD_PAGE)(void *);
-void (*INIT_REPLACEMENT_ALGO)(long);
-void (*CLEANUP_REPLACEMENT)();
-long (*GET_NUMBER_OF_PAGE_EVICTIONS)();
-
-
 void load_and_run_elf(char** exe);
 
 void assign_replacement_mode(char *mode);
 
+void parse_loader_options(char **exe);
+
 void initialise_global_data_structures(char **exe);
 
+void initialise_page_table();
+
 void setup_signal_handler();
 
 void segfault_handler(int sig, siginfo_t *info, void *context);
 
+void setup_userfault();
+
+void handle_userfault(void *fault_addr, int is_write);
+
+void handle_reference_fault(PageDescriptor *page, void *fault_addr);
+
+void handle_write_fault(PageDescriptor *page, void *fault_addr);
+
+int resident_page_protection(PageDescriptor *page);
+
+int segment_is_writable(int idx_of_segment);
+
+void clear_reference_of_page_number(unsigned long page_number);
+
+void sample_references();
+
+void make_room_for_page(unsigned long incoming_page_number);
+
+void adapt_frame_budget(int is_page_fault);
+
+void prefault_warm_start();
+
+void save_warm_start();
+
 int find_segment_of_fault(void *fault_addr);
 
-void allocate_page(int idx_of_segment_having_fa, void* fault_addr);
+void allocate_page(int idx_of_segment_having_fa, void* fault_addr, int is_write);
+
+int fault_is_write(void *context);
+
+int can_map_zero_page(int idx_of_segment, unsigned long page_start);
+
+void map_zero_page(unsigned long page_start);
+
+void commit_zero_page(PageDescriptor *page, void *fault_addr);
+
+int map_page(int idx_of_segment, unsigned long page_start);
+
+int map_file_page(int idx_of_segment, unsigned long page_start, unsigned long file_offset);
+
+int segment_protection(int idx_of_segment);
+
+int can_map_from_file(int idx_of_segment, unsigned long page_start);
+
+int page_shared_with_other_segment(int idx_of_segment, unsigned long page_start);
+
+void fault_around(int idx_of_segment, unsigned long first_page_start);
+
+void confirm_readahead_window(unsigned long marker_start);
+
+void prefetch_predicted_pages(unsigned long page_number);
 
 long calculate_page_waste(void* page_addr);
 
+void add_resident_page_waste(unsigned long page_number, void *ctx);
+
+void unmap_resident_page(unsigned long page_number, void *ctx);
+
 void calculate_internal_fragmentation();
 
 void print_stats();
@@ -68,15 +167,24 @@ void loader_cleanup();
 
 /* Load and run the ELF executable file */
 void load_and_run_elf(char** exe) {
-    /* Assigning fucntion pointers according to the replacement mode chosen by the user */
+    /* Choosing the replacement policy requested by the user */
     assign_replacement_mode(exe[2]);
 
+    /* Optional flags following the max number of pages */
+    parse_loader_options(exe);
+
     /* Initializing SEGMENTS array with the all the info of the phdrs of type load */
     initialise_global_data_structures(exe);
 
     /* Custom signal handler for SIGSEGV */
     setup_signal_handler();
 
+    /* Missing pages reported by userfaultfd instead, if asked for and allowed */
+    if (OPTIONS.userfaultfd) setup_userfault();
+
+    /* The resident set of the previous run, in bulk instead of one fault per page */
+    if (OPTIONS.warm_start_path) prefault_warm_start();
+
     /* Address of entry point */
     void *entry = (void*) EHDR->e_entry;
 
@@ -87,27 +195,80 @@ void load_and_run_elf(char** exe) {
     printf("-----------------------------------------------------------------------------\n");
     printf("User _start return value = %d\n",result);
 
+    if (OPTIONS.warm_start_path) save_warm_start();
     print_stats();
+    if (OPTIONS.miss_ratio_curve) print_miss_ratio_curve();
 }
 
 
 void assign_replacement_mode(char *mode) {
+    POLICY = find_replacement_policy(mode);
+    if (POLICY == NULL) {
+        POLICY = &REPLACEMENT_POLICIES[0];
+        POLICY_RECOGNIZED = 0;
+    }
+}
 
-    if (strcmp("RANDOM", mode) == 0) {
-        MODE = RANDOM_REPLACEMENT_MODE;
-        ADD_PAGE = add_page_random;
-        INIT_REPLACEMENT_ALGO = init_random;
-        CLEANUP_REPLACEMENT = cleanup_random;
-        GET_NUMBER_OF_PAGE_EVICTIONS = page_evictions_random;
-    } 
-    else {
-        if (strcmp("FIFO", mode) == 0) MODE = FIFO_REPLACEMENT_MODE;
-        else MODE = UNDEFINED_REPLACEMENT_MODE;
-        ADD_PAGE = add_page_fifo;
-        INIT_REPLACEMENT_ALGO = init_fifo;
-        CLEANUP_REPLACEMENT = cleanup_fifo;
-        GET_NUMBER_OF_PAGE_EVICTIONS = page_evictions_fifo;
+
+
+/* Parses the flags after the three positional arguments into OPTIONS */
+void parse_loader_options(char **exe) {
+    if (!exe[3]) return;
+
+    for (int i = 4; exe[i]; i++) {
+        if (strcmp(exe[i], "--trace") == 0 && exe[i + 1]) {
+            OPTIONS.trace_path = exe[++i];
+        }
+        else if (strcmp(exe[i], "--trace-size") == 0 && exe[i + 1]) {
+            long mib = atol(exe[++i]);
+            if (mib <= 0) {printf("Invalid trace size entered\n"); exit(2);}
+            OPTIONS.trace_capacity = mib * 1024 * 1024;
+        }
+        else if (strcmp(exe[i], "--fault-around") == 0 && exe[i + 1]) {
+            OPTIONS.fault_around = atol(exe[++i]);
+            if (OPTIONS.fault_around < 0) {printf("Invalid fault-around window entered\n"); exit(2);}
+        }
+        else if (strcmp(exe[i], "--prefetch") == 0) {
+            OPTIONS.prefetch = 1;
+        }
+        else if (strcmp(exe[i], "--zswap") == 0 && exe[i + 1]) {
+            long kib = atol(exe[++i]);
+            if (kib <= 0) {printf("Invalid zswap budget entered\n"); exit(2);}
+            OPTIONS.zswap_budget = kib * 1024;
+        }
+        else if (strcmp(exe[i], "--swap-backend") == 0 && exe[i + 1]) {
+            OPTIONS.swap_backend = exe[++i];
+        }
+        else if (strcmp(exe[i], "--swap-msync") == 0) {
+            OPTIONS.swap_msync = 1;
+        }
+        else if (strcmp(exe[i], "--swap-dontneed") == 0) {
+            OPTIONS.swap_dontneed = 1;
+        }
+        else if (strcmp(exe[i], "--userfaultfd") == 0) {
+            OPTIONS.userfaultfd = 1;
+        }
+        else if (strcmp(exe[i], "--adaptive") == 0 && exe[i + 1]) {
+            int fields = sscanf(exe[++i], "%ld,%ld,%ld,%ld", &OPTIONS.budget_floor, &OPTIONS.budget_ceiling,
+                                &OPTIONS.pff_grow_interval_us, &OPTIONS.pff_shrink_interval_us);
+            if ((fields != 2 && fields != 4) || OPTIONS.budget_floor < 2 || OPTIONS.budget_ceiling < OPTIONS.budget_floor ||
+                OPTIONS.pff_grow_interval_us < 0 || OPTIONS.pff_shrink_interval_us < OPTIONS.pff_grow_interval_us) {
+                printf("Invalid adaptive budget entered, expected <Floor>,<Ceiling>[,<GrowUs>,<ShrinkUs>] with 2 <= Floor <= Ceiling\n");
+                exit(2);
+            }
+        }
+        else if (strcmp(exe[i], "--budget-log") == 0 && exe[i + 1]) {
+            OPTIONS.budget_log_path = exe[++i];
+        }
+        else if (strcmp(exe[i], "--warm-start") == 0 && exe[i + 1]) {
+            OPTIONS.warm_start_path = exe[++i];
+        }
+        else if (strcmp(exe[i], "--mrc") == 0) {
+            OPTIONS.miss_ratio_curve = 1;
+        }
+        else {printf("Unknown or incomplete option: %s\n", exe[i]); exit(2);}
     }
+    if (OPTIONS.budget_log_path && !OPTIONS.budget_ceiling) {printf("--budget-log needs --adaptive\n"); exit(2);}
 }
 
 
@@ -182,12 +343,41 @@ void initialise_global_data_structures(char **exe) {
         }
     }
     if (idx_of_segment_to_load != NUMBER_OF_SEGMENTS_TO_LOAD) {printf("Mismatch in idx and number of segments to load after iteration"); exit(2);}
+
+    initialise_page_table();
     
     if (exe[3]) {
         long max_pages = atol(exe[3]);
         if (max_pages <= 0) {printf("Invalid number of max pages entered"); exit(2);}
-        INIT_REPLACEMENT_ALGO(max_pages);   /* Initialising the replacement system */
-        init_swap_system(max_pages);    /* Initialising the swap system */
+        MAX_PAGES = max_pages;
+
+        /* With --adaptive max_pages is only the starting budget, everything sized by the budget is sized for the
+         * ceiling and the smallest window is the floor's */
+        long capacity = max_pages, smallest_budget = max_pages;
+        if (OPTIONS.budget_ceiling) {
+            MAX_PAGES = init_frame_budget(OPTIONS.budget_floor, OPTIONS.budget_ceiling, max_pages,
+                OPTIONS.pff_grow_interval_us, OPTIONS.pff_shrink_interval_us, OPTIONS.budget_log_path);
+            capacity = OPTIONS.budget_ceiling;
+            smallest_budget = OPTIONS.budget_floor;
+        }
+
+        /* Initialising the replacement system */
+        POLICY_HOST.clear_reference = clear_reference_of_page_number;
+        POLICY_STATE = POLICY->create(capacity, &POLICY_HOST);
+        if (POLICY->resize && MAX_PAGES != capacity) POLICY->resize(POLICY_STATE, MAX_PAGES);
+        /* Prefetching may evict pages, so the window is kept to half of the remaining frames: the pages an
+         * instruction needs together (code and data) must survive the prefetch of its fault, or it faults forever */
+        FAULT_AROUND_WINDOW = (OPTIONS.fault_around < (smallest_budget - 1) / 2) ? OPTIONS.fault_around : (smallest_budget - 1) / 2;
+
+        if (POLICY->samples_references || OPTIONS.miss_ratio_curve) REFERENCE_SAMPLING_INTERVAL = MAX_PAGES / 4 + 1;
+
+        init_swap_system(capacity);    /* Initialising the swap system */
+        if (OPTIONS.zswap_budget) init_zswap(OPTIONS.zswap_budget);
+
+        if (OPTIONS.miss_ratio_curve) init_reuse_distance(FIRST_PAGE_NUMBER, NUMBER_OF_PAGES);
+        if (OPTIONS.prefetch) init_prefetcher(FIRST_PAGE_NUMBER, NUMBER_OF_PAGES);
+        if (OPTIONS.warm_start_path) init_warm_start(OPTIONS.warm_start_path, EHDR->e_entry, FIRST_PAGE_NUMBER, NUMBER_OF_PAGES);
+        if (OPTIONS.trace_path) start_fault_trace(OPTIONS.trace_path, OPTIONS.trace_capacity, MAX_PAGES, POLICY->name);
     } else {printf("Invalid number of max pages entered"); exit(2);}
     
 }
@@ -195,6 +385,58 @@ void initialise_global_data_structures(char **exe) {
 
 
 
+/* Builds the page descriptor table spanning all the PT_LOAD segments */
+void initialise_page_table() {
+    unsigned long first = (unsigned long)-1, last = 0;
+
+    for (int i = 0; i < NUMBER_OF_SEGMENTS_TO_LOAD; i++) {
+        if (PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz == 0) continue;
+        unsigned long seg_first = PHDRS_OF_SEGMENTS_TO_LOAD[i].p_vaddr / PAGE_SIZE_IN_BYTES;
+        unsigned long seg_last = (PHDRS_OF_SEGMENTS_TO_LOAD[i].p_vaddr + PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz - 1) / PAGE_SIZE_IN_BYTES;
+        if (seg_first < first) first = seg_first;
+        if (seg_last > last) last = seg_last;
+    }
+    if (first > last) {printf("No PT_LOAD segment with a non zero size\n"); exit(2);}
+
+    FIRST_PAGE_NUMBER = first;
+    NUMBER_OF_PAGES = last - first + 1;
+
+    PAGE_TABLE = (PageDescriptor *) malloc(NUMBER_OF_PAGES * sizeof(PageDescriptor));
+    SEGMENT_PAGE_TABLES = (PageDescriptor **) calloc(NUMBER_OF_SEGMENTS_TO_LOAD, sizeof(PageDescriptor *));
+    if (!PAGE_TABLE || !SEGMENT_PAGE_TABLES) {printf("Memory Allocation for page table failed\n"); exit(2);}
+
+    for (unsigned long i = 0; i < NUMBER_OF_PAGES; i++) {
+        PAGE_TABLE[i].flags = 0;
+        PAGE_TABLE[i].swap_slot = -1;
+        PAGE_TABLE[i].seg_idx = -1;
+    }
+
+    /* A page shared by two segments belongs to the first one, as in the segment search it replaces */
+    for (int i = 0; i < NUMBER_OF_SEGMENTS_TO_LOAD; i++) {
+        if (PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz == 0) continue;
+        unsigned long seg_first = PHDRS_OF_SEGMENTS_TO_LOAD[i].p_vaddr / PAGE_SIZE_IN_BYTES;
+        unsigned long seg_last = (PHDRS_OF_SEGMENTS_TO_LOAD[i].p_vaddr + PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz - 1) / PAGE_SIZE_IN_BYTES;
+
+        SEGMENT_PAGE_TABLES[i] = &PAGE_TABLE[seg_first - FIRST_PAGE_NUMBER];
+        for (unsigned long p = seg_first; p <= seg_last; p++) {
+            if (PAGE_TABLE[p - FIRST_PAGE_NUMBER].seg_idx == -1) PAGE_TABLE[p - FIRST_PAGE_NUMBER].seg_idx = i;
+        }
+    }
+}
+
+
+
+
+/* Returns the descriptor of the page containing addr, NULL if outside the page table */
+PageDescriptor *get_page_descriptor(void *addr) {
+    unsigned long page_number = (unsigned long)addr / PAGE_SIZE_IN_BYTES;
+    if (page_number < FIRST_PAGE_NUMBER || page_number - FIRST_PAGE_NUMBER >= NUMBER_OF_PAGES) return NULL;
+    return &PAGE_TABLE[page_number - FIRST_PAGE_NUMBER];
+}
+
+
+
+
 void setup_signal_handler() {
     struct sigaction sa;
     
@@ -215,50 +457,242 @@ void setup_signal_handler() {
 
 
 void segfault_handler(int sig, siginfo_t *info, void *context) {
-
-    /* Incrementing number of page faults for book keeping */
-    PAGE_FAULTS++;
+    int is_page_fault = 0;
 
     /* Obtain fault address (Virtual) */
     void *fault_addr = info->si_addr; 
 
+    if (OPTIONS.budget_ceiling) frame_budget_enter_handler();
+
     /* Find segment in which page fault occurred */
-    int seg_idx = find_segment_of_fault(fault_addr);
+    PageDescriptor *page = get_page_descriptor(fault_addr);
+    int seg_idx = page ? page->seg_idx : -1;
+
+    if (seg_idx != -1 && (page->flags & PAGE_RESIDENT) && !(page->flags & PAGE_REFERENCED)) {
+        /* Resident page downgraded by the replacement policy, only its referenced bit needs setting */
+        handle_reference_fault(page, fault_addr);
+    }
+    else if (seg_idx != -1 && (page->flags & PAGE_RESIDENT) && !(page->flags & PAGE_DIRTY) && segment_is_writable(seg_idx)) {
+        /* First write to a clean page, it now has to be written back on eviction */
+        handle_write_fault(page, fault_addr);
+    }
+    else if (seg_idx != -1 && (page->flags & PAGE_ZERO_MAPPED)) {
+        /* First write to a page still sharing the zero page, it needs a frame of its own now */
+        commit_zero_page(page, fault_addr);
+    }
+    else if (seg_idx != -1 && !(page->flags & PAGE_RESIDENT)) {
+        /* Incrementing number of page faults for book keeping */
+        PAGE_FAULTS++;
+        is_page_fault = 1;
 
-    if (seg_idx != -1) {
         /* Allocate page to this segment */
-        allocate_page(seg_idx, fault_addr); 
+        allocate_page(seg_idx, fault_addr, fault_is_write(context)); 
     }
     else {
         char msg1[] = "Unable to find segment, not a page fault\n";
         write(STDOUT_FILENO, msg1, sizeof(msg1) - 1);
         _exit(1);
     }
+
+    adapt_frame_budget(is_page_fault);
 }
 
 
 
 
-/* Returns the idx of phdr of segment of a given fault address, returns null if not in any segment */
-int find_segment_of_fault(void *fault_addr) {
-    unsigned long fa = (unsigned long) fault_addr;    /* Virtual address of the fault */
+/* Maps every run of segment pages anonymous and registers it with userfaultfd, SIGSEGV stays in charge if the
+ * kernel refuses */
+void setup_userfault() {
+    if (!start_userfault_handler(handle_userfault)) {
+        printf("userfaultfd is not available, page faults are handled with SIGSEGV\n");
+        return;
+    }
+
+    for (unsigned long i = 0; i < NUMBER_OF_PAGES; ) {
+        if (PAGE_TABLE[i].seg_idx == -1) {i++; continue;}
+
+        unsigned long run_end = i;
+        while (run_end < NUMBER_OF_PAGES && PAGE_TABLE[run_end].seg_idx != -1) run_end++;
+
+        if (!register_userfault_range((FIRST_PAGE_NUMBER + i) * PAGE_SIZE_IN_BYTES, (run_end - i) * PAGE_SIZE_IN_BYTES)) {
+            printf("userfaultfd registration failed, page faults are handled with SIGSEGV\n");
+            stop_userfault_handler();
+            return;
+        }
+        i = run_end;
+    }
+}
+
+
+
+
+/* Missing page reported to the userfaultfd thread, the guest sleeps until the thread wakes it after this returns */
+void handle_userfault(void *fault_addr, int is_write) {
+    PageDescriptor *page = get_page_descriptor(fault_addr);
+    if (!page || page->seg_idx == -1) {
+        char msg1[] = "Unable to find segment of a userfaultfd fault\n";
+        write(STDOUT_FILENO, msg1, sizeof(msg1) - 1);
+        _exit(1);
+    }
+    if (page->flags & (PAGE_RESIDENT | PAGE_ZERO_MAPPED)) return;
+
+    if (OPTIONS.budget_ceiling) frame_budget_enter_handler();
+    PAGE_FAULTS++;
+    allocate_page(page->seg_idx, fault_addr, is_write);
+    adapt_frame_budget(1);
+}
+
+
+
+
+/* Soft fault on a resident page: restore its protection and mark it referenced */
+void handle_reference_fault(PageDescriptor *page, void *fault_addr) {
+    SOFT_PAGE_FAULTS++;
+    record_fault((unsigned long)fault_addr / PAGE_SIZE_IN_BYTES, page->seg_idx, TRACE_SOURCE_REFERENCE);
+    record_reference((unsigned long)fault_addr / PAGE_SIZE_IN_BYTES);
+
+    unsigned long page_start = ((unsigned long)fault_addr / PAGE_SIZE_IN_BYTES) * PAGE_SIZE_IN_BYTES;
+    if (mprotect((void*)page_start, PAGE_SIZE_IN_BYTES, resident_page_protection(page)) == -1) {
+        perror("mprotect referenced page");
+        _exit(1);
+    }
+    page->flags |= PAGE_REFERENCED;
+
+    /* A prefetched page seen being accessed, or the marker of a readahead window reached */
+    if (page->flags & PAGE_READAHEAD) {
+        confirm_readahead_window(page_start);
+        fault_around(page->seg_idx, page_start + PAGE_SIZE_IN_BYTES);
+    }
+    else if (page->flags & PAGE_PREFETCHED) {
+        page->flags &= ~PAGE_PREFETCHED;
+        PREFETCHED_PAGES_USED++;
+    }
+
+    /* A correct prediction stands for the fault it avoided, the prefetcher trains on it and predicts onwards */
+    if (page->flags & PAGE_PREDICTED) {
+        page->flags &= ~PAGE_PREDICTED;
+        PREDICTED_PAGES_USED++;
+        prefetch_predicted_pages(page_start / PAGE_SIZE_IN_BYTES);
+    }
+
+    if (POLICY->on_access) POLICY->on_access(POLICY_STATE, (unsigned long)fault_addr / PAGE_SIZE_IN_BYTES);
+}
+
+
+
+
+/* Write fault on a clean resident page of a writable segment: make it writable and mark it dirty */
+void handle_write_fault(PageDescriptor *page, void *fault_addr) {
+    WRITE_FAULTS++;
+
+    unsigned long page_start = ((unsigned long)fault_addr / PAGE_SIZE_IN_BYTES) * PAGE_SIZE_IN_BYTES;
+    page->flags |= PAGE_DIRTY;
+    if (mprotect((void*)page_start, PAGE_SIZE_IN_BYTES, PAGE_PROTECTION) == -1) {
+        perror("mprotect written page");
+        _exit(1);
+    }
+
+    /* The write is an access seen by the loader like a reference soft fault */
+    record_fault(page_start / PAGE_SIZE_IN_BYTES, page->seg_idx, TRACE_SOURCE_REFERENCE);
+    record_reference(page_start / PAGE_SIZE_IN_BYTES);
+    if (POLICY->on_access) POLICY->on_access(POLICY_STATE, page_start / PAGE_SIZE_IN_BYTES);
+}
+
+
+
+
+/* Protection of a resident page being accessed: clean pages of writable segments stay read-only to catch the first
+ * write, pages mapped from the ELF keep their segment's protection */
+int resident_page_protection(PageDescriptor *page) {
+    if (page->flags & PAGE_FILE_MAPPED) return segment_protection(page->seg_idx);
+    if (segment_is_writable(page->seg_idx) && !(page->flags & PAGE_DIRTY)) return PROT_READ | PROT_EXEC;
+    return PAGE_PROTECTION;
+}
+
+
+
+
+int segment_is_writable(int idx_of_segment) {
+    return (PHDRS_OF_SEGMENTS_TO_LOAD[idx_of_segment].p_flags & PF_W) != 0;
+}
+
+
+
+
+/* Clears the referenced bit of a resident page, downgrading it to PROT_NONE so the next access is caught */
+void clear_page_reference(void *page_start_addr) {
+    PageDescriptor *page = get_page_descriptor(page_start_addr);
+
+    if (mprotect(page_start_addr, PAGE_SIZE_IN_BYTES, PROT_NONE) == -1) {
+        perror("mprotect unreferenced page");
+        _exit(1);
+    }
+    page->flags &= ~PAGE_REFERENCED;
+}
+
 
-    for (int i = 0; i < NUMBER_OF_SEGMENTS_TO_LOAD; i++) {
-        unsigned long seg_start = (unsigned long) PHDRS_OF_SEGMENTS_TO_LOAD[i].p_vaddr;
-        unsigned long seg_end = seg_start + (unsigned long) PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz;
 
-        if (seg_start <= fa && fa < seg_end) {
-            return i;
-        }    
+
+/* Host service for the policies, which identify pages by page number */
+void clear_reference_of_page_number(unsigned long page_number) {
+    clear_page_reference((void*)(page_number * PAGE_SIZE_IN_BYTES));
+}
+
+
+
+
+/* Clears the referenced bit of every resident page, so their next accesses are reported to the policy */
+void sample_references() {
+    for (unsigned long i = 0; i < NUMBER_OF_PAGES; i++) {
+        if ((PAGE_TABLE[i].flags & PAGE_RESIDENT) && (PAGE_TABLE[i].flags & PAGE_REFERENCED)) {
+            clear_reference_of_page_number(FIRST_PAGE_NUMBER + i);
+        }
     }
-    return -1;
+}
+
+
+
+
+/* Evicts the pages chosen by the policy while the resident set is at its budget, more than one after the adaptive
+ * budget shrank */
+void make_room_for_page(unsigned long incoming_page_number) {
+    while (RESIDENT_PAGES >= MAX_PAGES) {
+        unsigned long victim = POLICY->choose_victim(POLICY_STATE, incoming_page_number);
+        evict_page((void*)(victim * PAGE_SIZE_IN_BYTES));
+        PAGE_EVICTIONS++;
+    }
+}
+
+
+
+
+/* Ends a handled fault for the page fault frequency estimator (--adaptive) and applies the budget it returns, a
+ * smaller budget is reached by evicting at the next faults */
+void adapt_frame_budget(int is_page_fault) {
+    if (!OPTIONS.budget_ceiling) return;
+
+    long budget = frame_budget_leave_handler(is_page_fault, RESIDENT_PAGES);
+    if (budget == MAX_PAGES) return;
+
+    MAX_PAGES = budget;
+    if (REFERENCE_SAMPLING_INTERVAL) REFERENCE_SAMPLING_INTERVAL = budget / 4 + 1;
+    if (POLICY->resize) POLICY->resize(POLICY_STATE, budget);
+}
+
+
+
+
+/* Returns the idx of phdr of segment of a given fault address, returns -1 if not in any segment */
+int find_segment_of_fault(void *fault_addr) {
+    PageDescriptor *page = get_page_descriptor(fault_addr);
+    return page ? page->seg_idx : -1;
 }
 
 
 
 
 /* Allocate page for the fault address and store it's access info in the segment */
-void allocate_page(int idx_of_segment_having_fa, void* fault_addr) {
+void allocate_page(int idx_of_segment_having_fa, void* fault_addr, int is_write) {
     Elf32_Phdr* segment = &PHDRS_OF_SEGMENTS_TO_LOAD[idx_of_segment_having_fa];
     
     if (segment == NULL || fault_addr == NULL) {
@@ -271,30 +705,87 @@ void allocate_page(int idx_of_segment_having_fa, void* fault_addr) {
     unsigned long fa = (unsigned long) fault_addr;
     unsigned long page_start = (fa / PAGE_SIZE_IN_BYTES) * PAGE_SIZE_IN_BYTES;
 
+    /* Sampling first, so the page brought in now keeps its referenced bit */
+    if (REFERENCE_SAMPLING_INTERVAL && ++FAULTS_SINCE_REFERENCE_SAMPLING >= REFERENCE_SAMPLING_INTERVAL) {
+        FAULTS_SINCE_REFERENCE_SAMPLING = 0;
+        sample_references();
+    }
+
+    /* Reads of untouched BSS share the zero page and take no frame until their first write */
+    if (!is_write && can_map_zero_page(idx_of_segment_having_fa, page_start)) {
+        map_zero_page(page_start);
+        record_fault(page_start / PAGE_SIZE_IN_BYTES, idx_of_segment_having_fa, TRACE_SOURCE_ZERO);
+        record_reference(page_start / PAGE_SIZE_IN_BYTES);
+        return;
+    }
+
+    /* Predicted pages and neighbours first, so the demand page is the newest and cannot be evicted to make room for them */
+    if (OPTIONS.prefetch) prefetch_predicted_pages(page_start / PAGE_SIZE_IN_BYTES);
+    if (FAULT_AROUND_WINDOW) fault_around(idx_of_segment_having_fa, page_start + PAGE_SIZE_IN_BYTES);
+
+    int source = map_page(idx_of_segment_having_fa, page_start);
+
+    record_fault(page_start / PAGE_SIZE_IN_BYTES, idx_of_segment_having_fa, source);
+    record_reference(page_start / PAGE_SIZE_IN_BYTES);
+}
+
+
+
+
+/* Maps and fills a non resident page of a segment, returns where its content came from (TRACE_SOURCE_*) */
+int map_page(int idx_of_segment, unsigned long page_start) {
+    Elf32_Phdr* segment = &PHDRS_OF_SEGMENTS_TO_LOAD[idx_of_segment];
+
     /* Calculate file offset */
     unsigned long page_offset_in_segment = page_start - segment->p_vaddr;
     unsigned long file_offset = segment->p_offset + page_offset_in_segment;
 
-    /* Using MAP_FIXED to map at exact virtual address */
-    void *virtual_mem = mmap(
-        (void*)page_start,
-        PAGE_SIZE_IN_BYTES, 
-        PROT_READ|PROT_WRITE|PROT_EXEC, 
-        MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
-        -1, 0
-    );
-    
-    if (virtual_mem == MAP_FAILED) {
-        perror("mmap page");
-        _exit(1);
+    /* A swapped out page starts coming in while the victim is given up */
+    begin_swap_in((void *)page_start);
+
+    /* The victim is given up before mapping, so at most max_pages are ever resident */
+    make_room_for_page(page_start / PAGE_SIZE_IN_BYTES);
+    record_first_touch(page_start / PAGE_SIZE_IN_BYTES);
+
+    PageDescriptor *page = get_page_descriptor((void*)page_start);
+
+    /* Read-only pages backed by the file are mapped from it, sharing the kernel page cache without a copy.
+     * A file mapping would replace the registered range, so not with userfaultfd. */
+    if (!(page->flags & PAGE_SWAPPED) && !userfault_enabled() && can_map_from_file(idx_of_segment, page_start)) {
+        return map_file_page(idx_of_segment, page_start, file_offset);
+    }
+
+    void *virtual_mem;
+    if (userfault_enabled()) {
+        /* The page stays missing until it is installed whole below */
+        virtual_mem = USERFAULT_PAGE;
+    }
+    else {
+        /* Using MAP_FIXED to map at exact virtual address */
+        virtual_mem = mmap(
+            (void*)page_start,
+            PAGE_SIZE_IN_BYTES, 
+            PROT_READ|PROT_WRITE|PROT_EXEC, 
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+            -1, 0
+        );
+        
+        if (virtual_mem == MAP_FAILED) {
+            perror("mmap page");
+            _exit(1);
+        }
     }
 
     
-    if (load_from_swap_if_exists((void *)page_start)) {
+    int source = TRACE_SOURCE_ZERO;
+
+    if (load_from_swap_if_exists((void *)page_start, virtual_mem)) {
         /* Will just load data if the page exists in the swap file */
+        source = TRACE_SOURCE_SWAP;
     }
     /* Load data from file if within p_filesz */
     else if (page_offset_in_segment < segment->p_filesz) {
+        source = TRACE_SOURCE_ELF;
         size_t bytes_to_read = PAGE_SIZE_IN_BYTES;
         if (page_offset_in_segment + PAGE_SIZE_IN_BYTES > segment->p_filesz) {
             bytes_to_read = segment->p_filesz - page_offset_in_segment;
@@ -315,41 +806,341 @@ void allocate_page(int idx_of_segment_having_fa, void* fault_addr) {
             memset((char*)virtual_mem + bytes_to_read, 0, PAGE_SIZE_IN_BYTES - bytes_to_read);
         }
 
-    } else {
+    } else if (!userfault_enabled()) {
         memset(virtual_mem, 0, PAGE_SIZE_IN_BYTES);
     }
 
+    /* The faulting thread is woken by the userfaultfd thread once the page's bookkeeping is done */
+    if (userfault_enabled()) {
+        if (source == TRACE_SOURCE_ZERO) userfault_zero(page_start);
+        else userfault_copy(page_start, USERFAULT_PAGE);
+        virtual_mem = (void*)page_start;
+    }
+
     /* Update number of pages of this segment */
-    PAGES_ALLOCED_TO_SEGMENT[idx_of_segment_having_fa]++;
+    PAGES_ALLOCED_TO_SEGMENT[idx_of_segment]++;
 
-    /* Adding page, algo specific fucntion */
-    ADD_PAGE((void*)page_start);
+    /* Pages of writable segments start clean and read-only, the first write marks them dirty */
+    page->flags |= PAGE_RESIDENT | PAGE_REFERENCED;
+    if (segment->p_flags & PF_W) {
+        if (mprotect(virtual_mem, PAGE_SIZE_IN_BYTES, resident_page_protection(page)) == -1) {
+            perror("mprotect clean page");
+            _exit(1);
+        }
+    }
+
+    /* Handing the page to the replacement policy */
+    POLICY->on_fault(POLICY_STATE, page_start / PAGE_SIZE_IN_BYTES);
+    RESIDENT_PAGES++;
 
 
     PAGE_ALLOCATIONS++;
+    return source;
 }
 
 
 
 
-/* Calculates total internal fragmentation after the execution */
-void calculate_internal_fragmentation() {
-    TOTAL_INTERNAL_FRAGMENTATION = 0;
+/* Maps a read-only page straight from the ELF with MAP_PRIVATE, the segment's protection applies */
+int map_file_page(int idx_of_segment, unsigned long page_start, unsigned long file_offset) {
+    void *virtual_mem = mmap(
+        (void*)page_start,
+        PAGE_SIZE_IN_BYTES,
+        segment_protection(idx_of_segment),
+        MAP_PRIVATE | MAP_FIXED,
+        FD, file_offset
+    );
+
+    if (virtual_mem == MAP_FAILED) {
+        perror("mmap file page");
+        _exit(1);
+    }
+
+    PAGES_ALLOCED_TO_SEGMENT[idx_of_segment]++;
+
+    PageDescriptor *page = get_page_descriptor((void*)page_start);
+    page->flags |= PAGE_RESIDENT | PAGE_REFERENCED | PAGE_FILE_MAPPED;
+
+    POLICY->on_fault(POLICY_STATE, page_start / PAGE_SIZE_IN_BYTES);
+    RESIDENT_PAGES++;
+
+    PAGE_ALLOCATIONS++;
+    FILE_MAPPED_PAGES++;
+    return TRACE_SOURCE_ELF;
+}
+
+
+
+
+/* A read-only page can be mapped from the file if the segment's bytes in it are all file bytes (no zero fill) and
+ * no other segment shares it. As with the kernel's ELF loader, bytes of the page past the segment then show the file
+ * instead of zeros, which the ELF format leaves unspecified. */
+int can_map_from_file(int idx_of_segment, unsigned long page_start) {
+    Elf32_Phdr* segment = &PHDRS_OF_SEGMENTS_TO_LOAD[idx_of_segment];
+    unsigned long page_end = page_start + PAGE_SIZE_IN_BYTES;
+    unsigned long file_end = segment->p_vaddr + segment->p_filesz;
+    unsigned long memory_end = segment->p_vaddr + segment->p_memsz;
+
+    if ((segment->p_flags & PF_W) || page_start < segment->p_vaddr) return 0;
+    if (((page_end < memory_end) ? page_end : memory_end) > file_end) return 0;
+
+    return !page_shared_with_other_segment(idx_of_segment, page_start);
+}
+
+
+
+
+int page_shared_with_other_segment(int idx_of_segment, unsigned long page_start) {
+    unsigned long page_end = page_start + PAGE_SIZE_IN_BYTES;
+
+    for (int i = 0; i < NUMBER_OF_SEGMENTS_TO_LOAD; i++) {
+        if (i == idx_of_segment || PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz == 0) continue;
+        unsigned long other_start = PHDRS_OF_SEGMENTS_TO_LOAD[i].p_vaddr;
+        unsigned long other_end = other_start + PHDRS_OF_SEGMENTS_TO_LOAD[i].p_memsz;
+        if (other_start < page_end && other_end > page_start) return 1;
+    }
+    return 0;
+}
 
-    if (MODE == FIFO_REPLACEMENT_MODE && FIFO_QUEUE) {
-        FIFOPage *curr = FIFO_QUEUE->Head;
-        while (curr) {
-            TOTAL_INTERNAL_FRAGMENTATION += calculate_page_waste(curr->address);
-            curr = curr->next_page;
+
+
+
+/* x86 page fault error code, bit 1 set by a write. Without it every fault is taken as a write, which only forgoes
+ * the zero page. */
+int fault_is_write(void *context) {
+#ifdef REG_ERR
+    return (((ucontext_t *)context)->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+#else
+    return 1;
+#endif
+}
+
+
+
+
+/* A page can share the zero page if it lies wholly past the file bytes of its writable segment, was never swapped
+ * out (so it still holds zeros) and belongs to no other segment */
+int can_map_zero_page(int idx_of_segment, unsigned long page_start) {
+    Elf32_Phdr* segment = &PHDRS_OF_SEGMENTS_TO_LOAD[idx_of_segment];
+    PageDescriptor *page = get_page_descriptor((void*)page_start);
+
+    if (!(segment->p_flags & PF_W) || (page->flags & PAGE_SWAPPED)) return 0;
+    if (page_start < segment->p_vaddr + segment->p_filesz) return 0;
+
+    return !page_shared_with_other_segment(idx_of_segment, page_start);
+}
+
+
+
+
+/* Maps a page read-only without giving it a frame: until it is written, the kernel backs it with its single shared
+ * zero page. It is neither resident nor known to the policy. */
+void map_zero_page(unsigned long page_start) {
+    if (userfault_enabled()) {
+        userfault_zero(page_start);
+        if (mprotect((void*)page_start, PAGE_SIZE_IN_BYTES, PROT_READ) == -1) {
+            perror("mprotect zero page");
+            _exit(1);
         }
-    } 
-    else if (MODE == RANDOM_REPLACEMENT_MODE && PAGES) {
-        for (int i = 0; i < PAGES->max_pages; i++) {
-            if (PAGES->adresses[i] != NULL) {
-                TOTAL_INTERNAL_FRAGMENTATION += calculate_page_waste(PAGES->adresses[i]);
-            }
+    }
+    else if (mmap((void*)page_start, PAGE_SIZE_IN_BYTES, PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        perror("mmap zero page");
+        _exit(1);
+    }
+
+    get_page_descriptor((void*)page_start)->flags |= PAGE_ZERO_MAPPED;
+    ZERO_PAGE_MAPPINGS++;
+}
+
+
+
+
+/* Write fault on a page sharing the zero page: once writable, the kernel's copy-on-write gives it a zero filled frame
+ * of its own, which now counts against the budget like any allocation */
+void commit_zero_page(PageDescriptor *page, void *fault_addr) {
+    WRITE_FAULTS++;
+    ZERO_PAGES_COMMITTED++;
+
+    unsigned long page_start = ((unsigned long)fault_addr / PAGE_SIZE_IN_BYTES) * PAGE_SIZE_IN_BYTES;
+    make_room_for_page(page_start / PAGE_SIZE_IN_BYTES);
+    record_first_touch(page_start / PAGE_SIZE_IN_BYTES);
+
+    if (mprotect((void*)page_start, PAGE_SIZE_IN_BYTES, PAGE_PROTECTION) == -1) {
+        perror("mprotect committed zero page");
+        _exit(1);
+    }
+
+    PAGES_ALLOCED_TO_SEGMENT[page->seg_idx]++;
+    page->flags &= ~PAGE_ZERO_MAPPED;
+    page->flags |= PAGE_RESIDENT | PAGE_REFERENCED | PAGE_DIRTY;
+
+    POLICY->on_fault(POLICY_STATE, page_start / PAGE_SIZE_IN_BYTES);
+    RESIDENT_PAGES++;
+    PAGE_ALLOCATIONS++;
+
+    /* The read fault was the miss, the write is an access like a dirty tracking write fault */
+    record_fault(page_start / PAGE_SIZE_IN_BYTES, page->seg_idx, TRACE_SOURCE_REFERENCE);
+    record_reference(page_start / PAGE_SIZE_IN_BYTES);
+}
+
+
+
+
+/* mmap protection of a segment's pages, from its p_flags */
+int segment_protection(int idx_of_segment) {
+    Elf32_Word p_flags = PHDRS_OF_SEGMENTS_TO_LOAD[idx_of_segment].p_flags;
+    int protection = PROT_NONE;
+
+    if (p_flags & PF_R) protection |= PROT_READ;
+    if (p_flags & PF_W) protection |= PROT_WRITE;
+    if (p_flags & PF_X) protection |= PROT_EXEC;
+    return protection;
+}
+
+
+
+
+/* Maps up to FAULT_AROUND_WINDOW non resident pages of the segment from first_page_start on, stopping at the first
+ * resident page or page sharing the zero page. The pages are marked prefetched and the last one becomes the readahead
+ * marker: it is left PROT_NONE, so reaching it confirms the window as used and starts the next one, one signal per
+ * window. */
+void fault_around(int idx_of_segment, unsigned long first_page_start) {
+    PageDescriptor *marker = NULL;
+    unsigned long marker_start = 0;
+
+    for (long i = 0; i < FAULT_AROUND_WINDOW; i++) {
+        unsigned long page_start = first_page_start + i * PAGE_SIZE_IN_BYTES;
+        PageDescriptor *page = get_page_descriptor((void*)page_start);
+        if (!page || page->seg_idx != idx_of_segment || (page->flags & (PAGE_RESIDENT | PAGE_ZERO_MAPPED))) break;
+
+        map_page(idx_of_segment, page_start);
+        page->flags |= PAGE_PREFETCHED;
+        PREFETCHED_PAGES++;
+
+        marker = page;
+        marker_start = page_start;
+    }
+
+    if (marker) {
+        clear_page_reference((void*)marker_start);
+        marker->flags |= PAGE_READAHEAD;
+    }
+}
+
+
+
+
+/* Loads the pages the prefetcher predicts after a fault of page_number into free frames, a single one may take an
+ * evicted page's frame when memory is full. They are left PROT_NONE, so their first access measures the accuracy. */
+void prefetch_predicted_pages(unsigned long page_number) {
+    unsigned long predictions[MAX_PREDICTIONS];
+    int number_of_predictions = predict_after_fault(page_number, predictions);
+
+    for (int i = 0; i < number_of_predictions; i++) {
+        void *page_start = (void*)(predictions[i] * PAGE_SIZE_IN_BYTES);
+        PageDescriptor *page = get_page_descriptor(page_start);
+        if (!page || page->seg_idx == -1 || (page->flags & (PAGE_RESIDENT | PAGE_ZERO_MAPPED)) || predictions[i] == page_number) continue;
+
+        /* With fewer than 4 frames an eviction could take a page the faulting instruction needs */
+        if (RESIDENT_PAGES >= MAX_PAGES && (i > 0 || MAX_PAGES < 4)) break;
+
+        map_page(page->seg_idx, (unsigned long)page_start);
+        clear_page_reference(page_start);
+        page->flags |= PAGE_PREDICTED;
+        PREDICTED_PAGES++;
+    }
+}
+
+
+
+
+/* Counts the prefetched pages of the window ending at the marker as used, they were consumed up to it */
+void confirm_readahead_window(unsigned long marker_start) {
+    PageDescriptor *marker = get_page_descriptor((void*)marker_start);
+    marker->flags &= ~PAGE_READAHEAD;
+
+    for (unsigned long page_start = marker_start; ; page_start -= PAGE_SIZE_IN_BYTES) {
+        PageDescriptor *page = get_page_descriptor((void*)page_start);
+        if (!page || page->seg_idx != marker->seg_idx || !(page->flags & PAGE_PREFETCHED)) break;
+
+        page->flags &= ~PAGE_PREFETCHED;
+        PREFETCHED_PAGES_USED++;
+    }
+}
+
+
+
+
+/* Maps the pages of the warm start profile in the order they were first touched, while the budget has room. They
+ * are not page faults, the guest finds them resident. */
+void prefault_warm_start() {
+    const uint32_t *pages;
+    long number_of_profile_pages = warm_start_profile(&pages);
+
+    for (long i = 0; i < number_of_profile_pages && RESIDENT_PAGES < MAX_PAGES; i++) {
+        unsigned long page_start = (unsigned long)pages[i] * PAGE_SIZE_IN_BYTES;
+        PageDescriptor *page = get_page_descriptor((void*)page_start);
+        if (!page || page->seg_idx == -1 || (page->flags & (PAGE_RESIDENT | PAGE_ZERO_MAPPED))) continue;
+
+        map_page(page->seg_idx, page_start);
+        WARM_START_PAGES++;
+    }
+}
+
+
+
+
+/* Saves the final resident set as the profile of the next run */
+void save_warm_start() {
+    POLICY->iterate_resident(POLICY_STATE, add_to_warm_start_profile, NULL);
+    save_warm_start_profile(PAGE_FAULTS, MAX_PAGES);
+}
+
+
+
+
+/* Evicts a resident page, the policy having already forgotten it */
+void evict_page(void *page_start_addr) {
+    PageDescriptor *page = get_page_descriptor(page_start_addr);
+
+    /* A clean page is identical to its swap slot or to the ELF, it is only dropped */
+    if (!(page->flags & PAGE_DIRTY) && segment_is_writable(page->seg_idx)) CLEAN_EVICTIONS++;
+
+    if (page->flags & PAGE_DIRTY) {
+        /* The page may have been downgraded to PROT_NONE by the replacement policy */
+        if (!(page->flags & PAGE_REFERENCED)) mprotect(page_start_addr, PAGE_SIZE_IN_BYTES, PROT_READ);
+        handle_page_eviction_to_swap(page_start_addr);
+    }
+
+    /* A registered page is dropped in place with its protection restored, so its next access is a missing fault */
+    if (userfault_enabled()) {
+        if (mprotect(page_start_addr, PAGE_SIZE_IN_BYTES, PAGE_PROTECTION) == -1 ||
+            madvise(page_start_addr, PAGE_SIZE_IN_BYTES, MADV_DONTNEED) == -1) {
+            perror("drop registered page");
+            _exit(1);
         }
     }
+    else munmap(page_start_addr, PAGE_SIZE_IN_BYTES);
+
+    if (page->flags & PAGE_PREFETCHED) PREFETCHED_PAGES_EVICTED_UNUSED++;
+    if (page->flags & PAGE_PREDICTED) PREDICTED_PAGES_EVICTED_UNUSED++;
+    page->flags &= ~(PAGE_RESIDENT | PAGE_DIRTY | PAGE_REFERENCED | PAGE_PREFETCHED | PAGE_READAHEAD | PAGE_PREDICTED | PAGE_FILE_MAPPED | PAGE_ZERO_MAPPED);
+    RESIDENT_PAGES--;
+}
+
+
+
+
+/* Calculates total internal fragmentation after the execution */
+void calculate_internal_fragmentation() {
+    TOTAL_INTERNAL_FRAGMENTATION = 0;
+    if (POLICY_STATE) POLICY->iterate_resident(POLICY_STATE, add_resident_page_waste, NULL);
+}
+
+
+
+void add_resident_page_waste(unsigned long page_number, void *ctx) {
+    TOTAL_INTERNAL_FRAGMENTATION += calculate_page_waste((void*)(page_number * PAGE_SIZE_IN_BYTES));
 }
 
 
@@ -377,36 +1168,79 @@ long calculate_page_waste(void* page_addr) {
 
 
 void print_stats() {
-    char *replacement_mode;
-    if (MODE == FIFO_REPLACEMENT_MODE) replacement_mode = "FIFO";
-    else if (MODE == RANDOM_REPLACEMENT_MODE) replacement_mode = "RANDOM";
-    else replacement_mode = "FIFO (By Default, was unable to recognize mode entered)";
-
     calculate_internal_fragmentation();
 
     printf("\n-----------------------------------------------------------------------------\n");
     printf("---------------------------- SmartLoader Stats ------------------------------\n");
     printf("-----------------------------------------------------------------------------\n");
-    printf("PAGE REPLACEMENT MODE: %s\n", replacement_mode);
+    printf("PAGE REPLACEMENT MODE: %s%s\n", POLICY->name, POLICY_RECOGNIZED ? "" : " (By Default, was unable to recognize mode entered)");
     printf("Page faults: %d\n", PAGE_FAULTS);
-    printf("Page allocations: %d\n", PAGE_ALLOCATIONS);
+    printf("Soft page faults (reference tracking): %d\n", SOFT_PAGE_FAULTS);
+    printf("Write faults (dirty tracking): %d\n", WRITE_FAULTS);
+    printf("Page allocations: %d (%ld mapped from the ELF without a copy)\n", PAGE_ALLOCATIONS, FILE_MAPPED_PAGES);
     printf("Total internal fragmentation: %ld Bytes (%.3f Kb) (%.3f Kib)\n", 
         TOTAL_INTERNAL_FRAGMENTATION, 
         (double)TOTAL_INTERNAL_FRAGMENTATION/1000.0,
         (double)TOTAL_INTERNAL_FRAGMENTATION/1024.0);
-    printf("Page evictions: %ld\n", GET_NUMBER_OF_PAGE_EVICTIONS());  
+    printf("Zero page: %ld BSS read faults shared it, %ld of those pages later written got a frame\n",
+        ZERO_PAGE_MAPPINGS, ZERO_PAGES_COMMITTED);
+    printf("Page evictions: %ld (%ld clean pages of writable segments dropped without a swap write)\n", PAGE_EVICTIONS, CLEAN_EVICTIONS);
+    if (FAULT_AROUND_WINDOW) {
+        printf("Fault-around (window %ld): %ld pages prefetched, %ld used, %ld evicted unused\n",
+            FAULT_AROUND_WINDOW, PREFETCHED_PAGES, PREFETCHED_PAGES_USED, PREFETCHED_PAGES_EVICTED_UNUSED);
+    }
+    if (OPTIONS.prefetch) {
+        /* Coverage: share of the would-be faults (real faults plus correct predictions) the prefetcher avoided */
+        printf("Prefetcher: %ld pages predicted, %ld used (accuracy %.1f%%), %ld evicted unused, coverage %.1f%%\n",
+            PREDICTED_PAGES, PREDICTED_PAGES_USED,
+            PREDICTED_PAGES ? 100.0 * PREDICTED_PAGES_USED / PREDICTED_PAGES : 0.0,
+            PREDICTED_PAGES_EVICTED_UNUSED,
+            PREDICTED_PAGES_USED + PAGE_FAULTS ?
+                100.0 * PREDICTED_PAGES_USED / (PREDICTED_PAGES_USED + PAGE_FAULTS) : 0.0);
+    }
+    print_frame_budget_stats();
+    print_warm_start_stats(WARM_START_PAGES, PAGE_FAULTS, MAX_PAGES);
+    print_userfault_stats();
+    print_swap_stats();
+    if (POLICY->stats) POLICY->stats(POLICY_STATE);
     printf("\n-----------------------------------------------------------------------------\n");
     printf("-----------------------------------------------------------------------------\n");
 }
 
 
 
+void unmap_resident_page(unsigned long page_number, void *ctx) {
+    munmap((void*)(page_number * PAGE_SIZE_IN_BYTES), PAGE_SIZE_IN_BYTES);
+}
+
+
+
 /* release memory and other cleanups */
 void loader_cleanup() {
     
-    CLEANUP_REPLACEMENT();
+    /* Resident pages are dropped without writing them back, the swap file is discarded anyway */
+    stop_userfault_handler();
+    if (POLICY_STATE) {
+        POLICY->iterate_resident(POLICY_STATE, unmap_resident_page, NULL);
+        POLICY->destroy(POLICY_STATE);
+        POLICY_STATE = NULL;
+    }
+
+    /* Pages still sharing the zero page are known to no policy */
+    for (unsigned long i = 0; PAGE_TABLE && i < NUMBER_OF_PAGES; i++) {
+        if (PAGE_TABLE[i].flags & PAGE_ZERO_MAPPED) munmap((void*)((FIRST_PAGE_NUMBER + i) * PAGE_SIZE_IN_BYTES), PAGE_SIZE_IN_BYTES);
+    }
     cleanup_swap_system();
+    finish_fault_trace();
+    finish_frame_budget();
+    cleanup_warm_start();
+    cleanup_reuse_distance();
+    cleanup_prefetcher();
    
+    /* Free the page table if it is not null */
+    if (PAGE_TABLE) free(PAGE_TABLE);
+    if (SEGMENT_PAGE_TABLES) free(SEGMENT_PAGE_TABLES);
+
     /* Free segments if it is not null */
     if (PHDRS_OF_SEGMENTS_TO_LOAD) free(PHDRS_OF_SEGMENTS_TO_LOAD);
     if (PAGES_ALLOCED_TO_SEGMENT) free(PAGES_ALLOCED_TO_SEGMENT);
@@ -0,0 +1,35 @@
+#ifndef SWAP_BACKEND_H
+#define SWAP_BACKEND_H
+
+/*
+ * How swap.img is read and written, selected at launch with --swap-backend. The swap manager decides what is
+ * stored and where (a block is a page sized offset in swap.img), the backend only moves pages to and from blocks.
+ * Stored blocks are never rewritten until released, so a backend may keep a page in memory until its write is done.
+ */
+typedef struct SwapBackend {
+    const char *name;
+
+    /* Returns 0 if the backend can not run here, the swap manager then falls back to the default one */
+    int (*init)(int fd, int number_of_blocks);
+
+    /* Stores the page in the block, the page may change as soon as this returns */
+    void (*write_block)(int block, const void *page_addr);
+
+    /* Starts reading a block that read_block will be asked for soon, may be NULL */
+    void (*begin_read)(int block);
+
+    void (*read_block)(int block, void *page_addr);
+
+    /* The block no longer holds a page, may be NULL */
+    void (*release_block)(int block);
+
+    void (*print_stats)();     /* May be NULL */
+    void (*cleanup)();
+} SwapBackend;
+
+extern const SwapBackend SYNC_SWAP_BACKEND;
+extern const SwapBackend WRITEBACK_SWAP_BACKEND;
+extern const SwapBackend URING_SWAP_BACKEND;
+extern const SwapBackend MMAP_SWAP_BACKEND;
+
+#endif
@@ -1,16 +1,188 @@
 #include "swap_manager.h"
 #include "loader.h"
+#include "zswap.h"
+#include "swap_backend.h"
+
+#include <string.h>
 
 #define MIN_SWAP_ENTRIES       1024    /* Minimum number of swap entries */
 #define MAX_ENTRY_MULTIPLIER   5       /* Multiple of Max Pages Allowed (high for safety) */
 
 #define IMAGE_FILE_NAME        "swap.img"
 
+/*
+ * A swap slot belongs to one page and names the stored copy (content) of what the page held when it was evicted.
+ * Contents are never modified once written, identical pages found through their hash share one by reference
+ * counting, and a content on disk lives in swap.img at its own index. A page stored again takes a content first
+ * and only then releases its old one, so a rewrite with unchanged data costs no I/O.
+ */
+typedef struct SwapContent {
+    unsigned long long hash;
+    int tier;                   /* SWAP_TIER_DISK or SWAP_TIER_ZSWAP */
+    int zswap_handle;           /* Location and size in the zswap pool */
+    int compressed_size;
+    int references;             /* Swap slots sharing the content */
+    int next_in_bucket;         /* Next content of the same hash bucket, -1 ends the chain */
+} SwapContent;
+
 /* Private Global Variables for Swapping */
 static int SWAP_FD = -1;
 static SwapEntry *SWAP_TABLE = NULL;
 static int MAX_SWAP_ENTRIES = 0;
 
+static int *FREE_SLOTS = NULL;          /* Stack of unused slots of SWAP_TABLE */
+static int NUMBER_OF_FREE_SLOTS = 0;
+
+static SwapContent *CONTENTS = NULL;    /* One more than the slots, a page holds its old content while storing */
+static int NUMBER_OF_CONTENTS = 0;
+static int *FREE_CONTENTS = NULL;
+static int NUMBER_OF_FREE_CONTENTS = 0;
+static int *HASH_BUCKETS = NULL;        /* First content of each bucket, -1 if empty */
+static unsigned long long HASH_BUCKET_MASK = 0;
+
+static const SwapBackend *BACKEND = NULL;
+
+/* The first one is the default */
+static const SwapBackend *SWAP_BACKENDS[] = {&WRITEBACK_SWAP_BACKEND, &SYNC_SWAP_BACKEND, &URING_SWAP_BACKEND, &MMAP_SWAP_BACKEND};
+#define NUMBER_OF_SWAP_BACKENDS ((int)(sizeof(SWAP_BACKENDS) / sizeof(SWAP_BACKENDS[0])))
+
+/* Swap-outs and swap-ins per tier, indexed by SWAP_TIER_* */
+static long SWAP_OUTS[3] = {0, 0, 0};
+static long SWAP_INS[3] = {0, 0, 0};
+
+static long DUPLICATE_PAGES = 0;        /* Swap-outs that shared an existing content */
+static long BYTES_NOT_WRITTEN = 0;      /* Zero and duplicate pages, in bytes */
+static long BYTES_NOT_READ = 0;         /* Zero pages swapped in without a read */
+static long VERIFICATION_READS = 0;     /* Disk contents read back to confirm a hash match */
+
+
+/* Takes a free slot, -1 if the swap table is full */
+static int allocate_swap_slot() {
+    if (NUMBER_OF_FREE_SLOTS == 0) return -1;
+    return FREE_SLOTS[--NUMBER_OF_FREE_SLOTS];
+}
+
+
+/* ORs the page 64 bytes at a time with vector registers, the compiler lowers the type to SSE/AVX or plain words */
+static int page_is_zero(const void *page_addr) {
+    typedef unsigned int ZeroCheckVector __attribute__((vector_size(16), aligned(16)));
+    const ZeroCheckVector *v = (const ZeroCheckVector *)page_addr;
+    ZeroCheckVector acc = {0, 0, 0, 0};
+
+    for (unsigned long i = 0; i < PAGE_SIZE_IN_BYTES / sizeof(ZeroCheckVector); i += 4) {
+        acc |= v[i] | v[i + 1] | v[i + 2] | v[i + 3];
+    }
+    return (acc[0] | acc[1] | acc[2] | acc[3]) == 0;
+}
+
+
+/* 64-bit multiply-rotate hash over the words of the page */
+static unsigned long long hash_page(const void *page_addr) {
+    const unsigned long long *words = (const unsigned long long *)page_addr;
+    unsigned long long hash = 0x9E3779B97F4A7C15ULL;
+
+    for (unsigned long i = 0; i < PAGE_SIZE_IN_BYTES / sizeof(unsigned long long); i++) {
+        hash = (hash ^ words[i]) * 0xFF51AFD7ED558CCDULL;
+        hash = (hash << 29) | (hash >> 35);
+    }
+    return hash ^ (hash >> 32);
+}
+
+
+/* Blocking backend, one pread or pwrite per page in the fault handler */
+static int SYNC_FD = -1;
+
+static int sync_init(int fd, int number_of_blocks) {
+    (void)number_of_blocks;
+    SYNC_FD = fd;
+    return 1;
+}
+
+static void sync_write_block(int block, const void *page_addr) {
+    if (pwrite(SYNC_FD, page_addr, PAGE_SIZE_IN_BYTES, (off_t)block * PAGE_SIZE_IN_BYTES) != PAGE_SIZE_IN_BYTES) {
+        perror("Swap write failed");
+        exit(1);
+    }
+}
+
+static void sync_read_block(int block, void *page_addr) {
+    if (pread(SYNC_FD, page_addr, PAGE_SIZE_IN_BYTES, (off_t)block * PAGE_SIZE_IN_BYTES) != PAGE_SIZE_IN_BYTES) {
+        perror("Swap read failed");
+        exit(1);
+    }
+}
+
+static void sync_cleanup() {
+    SYNC_FD = -1;
+}
+
+const SwapBackend SYNC_SWAP_BACKEND = {
+    "sync", sync_init, sync_write_block, NULL, sync_read_block, NULL, NULL, sync_cleanup
+};
+
+
+static void read_content_from_disk(int content, void *buffer) {
+    BACKEND->read_block(content, buffer);
+}
+
+
+/* A content holding exactly this page, -1 if none. A hash match is confirmed byte by byte before sharing. */
+static int find_identical_content(unsigned long long hash, const void *page_addr) {
+    unsigned char stored[PAGE_SIZE_IN_BYTES];
+
+    for (int c = HASH_BUCKETS[hash & HASH_BUCKET_MASK]; c != -1; c = CONTENTS[c].next_in_bucket) {
+        if (CONTENTS[c].hash != hash) continue;
+
+        if (CONTENTS[c].tier == SWAP_TIER_ZSWAP) zswap_load(CONTENTS[c].zswap_handle, CONTENTS[c].compressed_size, stored);
+        else {
+            read_content_from_disk(c, stored);
+            VERIFICATION_READS++;
+        }
+        if (memcmp(stored, page_addr, PAGE_SIZE_IN_BYTES) == 0) return c;
+    }
+    return -1;
+}
+
+
+/* Stores the page as a new content, in the compressed tier first, the disk only takes what it rejects */
+static int store_new_content(unsigned long long hash, void *page_addr) {
+    if (NUMBER_OF_FREE_CONTENTS == 0) {
+        printf("ERROR: Swap contents full. Increase MAX_SWAP_ENTRIES.\n");
+        exit(1);
+    }
+    int content = FREE_CONTENTS[--NUMBER_OF_FREE_CONTENTS];
+    SwapContent *c = &CONTENTS[content];
+
+    c->hash = hash;
+    c->references = 1;
+    c->next_in_bucket = HASH_BUCKETS[hash & HASH_BUCKET_MASK];
+    HASH_BUCKETS[hash & HASH_BUCKET_MASK] = content;
+
+    if (zswap_enabled() && zswap_store(page_addr, &c->zswap_handle, &c->compressed_size)) {
+        c->tier = SWAP_TIER_ZSWAP;
+        return content;
+    }
+    c->tier = SWAP_TIER_DISK;
+
+    BACKEND->write_block(content, page_addr);
+    return content;
+}
+
+
+/* Drops one reference, the last one unlinks the content from its bucket and frees its storage */
+static void release_content(int content) {
+    if (--CONTENTS[content].references > 0) return;
+
+    int *link = &HASH_BUCKETS[CONTENTS[content].hash & HASH_BUCKET_MASK];
+    while (*link != content) link = &CONTENTS[*link].next_in_bucket;
+    *link = CONTENTS[content].next_in_bucket;
+
+    if (CONTENTS[content].tier == SWAP_TIER_ZSWAP) zswap_free(CONTENTS[content].zswap_handle, CONTENTS[content].compressed_size);
+    else if (BACKEND->release_block) BACKEND->release_block(content);
+    FREE_CONTENTS[NUMBER_OF_FREE_CONTENTS++] = content;
+}
+
+
 void init_swap_system(long max_pages) {
     MAX_SWAP_ENTRIES = (int)max_pages * MAX_ENTRY_MULTIPLIER;
     if (MAX_SWAP_ENTRIES < MIN_SWAP_ENTRIES) MAX_SWAP_ENTRIES = MIN_SWAP_ENTRIES;
@@ -21,76 +193,155 @@ void init_swap_system(long max_pages) {
         exit(1);
     }
 
+    FREE_SLOTS = (int*) malloc(MAX_SWAP_ENTRIES * sizeof(int));
+    if (!FREE_SLOTS) {
+        perror("Failed to allocate swap free list");
+        exit(1);
+    }
+
+    /* Pushed in reverse so slots are handed out from the start of the swap table */
+    for (int i = 0; i < MAX_SWAP_ENTRIES; i++) FREE_SLOTS[i] = MAX_SWAP_ENTRIES - 1 - i;
+    NUMBER_OF_FREE_SLOTS = MAX_SWAP_ENTRIES;
+
+    NUMBER_OF_CONTENTS = MAX_SWAP_ENTRIES + 1;
+    unsigned long long number_of_buckets = 1;
+    while (number_of_buckets < (unsigned long long)NUMBER_OF_CONTENTS) number_of_buckets <<= 1;
+    HASH_BUCKET_MASK = number_of_buckets - 1;
+
+    CONTENTS = (SwapContent*) calloc(NUMBER_OF_CONTENTS, sizeof(SwapContent));
+    FREE_CONTENTS = (int*) malloc(NUMBER_OF_CONTENTS * sizeof(int));
+    HASH_BUCKETS = (int*) malloc(number_of_buckets * sizeof(int));
+    if (!CONTENTS || !FREE_CONTENTS || !HASH_BUCKETS) {
+        perror("Failed to allocate swap contents");
+        exit(1);
+    }
+
+    /* Same order for contents, they are handed out from the start of the swap file */
+    for (int i = 0; i < NUMBER_OF_CONTENTS; i++) FREE_CONTENTS[i] = NUMBER_OF_CONTENTS - 1 - i;
+    NUMBER_OF_FREE_CONTENTS = NUMBER_OF_CONTENTS;
+    for (unsigned long long b = 0; b < number_of_buckets; b++) HASH_BUCKETS[b] = -1;
+
     /* Open/Create the swap file */
     SWAP_FD = open(IMAGE_FILE_NAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
     if (SWAP_FD == -1) {
         perror("Failed to create swap file");
         exit(1);
     }
+
+    /* Selecting the backend, the default one takes over from a backend the kernel does not support */
+    for (int i = 0; i < NUMBER_OF_SWAP_BACKENDS && !BACKEND; i++) {
+        if (!OPTIONS.swap_backend || strcmp(SWAP_BACKENDS[i]->name, OPTIONS.swap_backend) == 0) BACKEND = SWAP_BACKENDS[i];
+    }
+    if (!BACKEND) {printf("Unknown swap backend: %s\n", OPTIONS.swap_backend); exit(2);}
+
+    if (!BACKEND->init(SWAP_FD, NUMBER_OF_CONTENTS)) {
+        printf("Swap backend %s is not available, using %s\n", BACKEND->name, SWAP_BACKENDS[0]->name);
+        BACKEND->cleanup();
+        BACKEND = SWAP_BACKENDS[0];
+        BACKEND->init(SWAP_FD, NUMBER_OF_CONTENTS);
+    }
+}
+
+/* Lets the backend start reading a page about to be swapped in, while the fault makes room for it */
+void begin_swap_in(void *page_addr) {
+    PageDescriptor *page = get_page_descriptor(page_addr);
+    if (!page || !(page->flags & PAGE_SWAPPED) || !BACKEND->begin_read) return;
+
+    SwapEntry *entry = &SWAP_TABLE[page->swap_slot];
+    if (entry->tier == SWAP_TIER_DISK) BACKEND->begin_read(entry->content);
 }
 
 void handle_page_eviction_to_swap(void *page_addr) {
-    int seg_idx = find_segment_of_fault(page_addr);
+    PageDescriptor *page = get_page_descriptor(page_addr);
+    if (!page || page->seg_idx == -1) return;
     
-    if (seg_idx != -1) {
-        if ((PHDRS_OF_SEGMENTS_TO_LOAD[seg_idx].p_flags & PF_W) == 0) {    /* Identification of read-only page */
-            return;     /* No need to add to swap, can be read from the elf only */
-        }
+    if ((PHDRS_OF_SEGMENTS_TO_LOAD[page->seg_idx].p_flags & PF_W) == 0) {    /* Identification of read-only page */
+        return;     /* No need to add to swap, can be read from the elf only */
     }
 
-    int slot = -1;
-    for (int i = 0; i < MAX_SWAP_ENTRIES; i++) {
-        /* Finding the slot of this addr (if exists) or the first available */
-        if (SWAP_TABLE[i].is_active && SWAP_TABLE[i].vaddr == page_addr) {
-            slot = i;
-            break;
-        }
-        if (!SWAP_TABLE[i].is_active && slot == -1) {
-            slot = i;
-        }
-    }
+    /* Reusing the slot of this page (if exists) or taking a free one */
+    int slot = page->swap_slot;
+    if (slot == -1) slot = allocate_swap_slot();
 
     if (slot == -1) {
         printf("ERROR: Swap table full. Increase MAX_SWAP_ENTRIES.\n");
         exit(1);
     }
 
-    /* Writing to disk */
-    off_t offset = slot * PAGE_SIZE_IN_BYTES;
-    if (lseek(SWAP_FD, offset, SEEK_SET) == -1) {
-        perror("Swap lseek failed"); 
-        exit(1);
-    }
-    
-    if (write(SWAP_FD, page_addr, PAGE_SIZE_IN_BYTES) != PAGE_SIZE_IN_BYTES) {
-        perror("Swap write failed");
-        exit(1);
+    /* Zero pages are metadata only, other pages look for an identical stored copy before writing one */
+    int content = -1, tier = SWAP_TIER_ZERO;
+    if (page_is_zero(page_addr)) BYTES_NOT_WRITTEN += PAGE_SIZE_IN_BYTES;
+    else {
+        unsigned long long hash = hash_page(page_addr);
+        content = find_identical_content(hash, page_addr);
+
+        if (content != -1) {
+            CONTENTS[content].references++;
+            DUPLICATE_PAGES++;
+            BYTES_NOT_WRITTEN += PAGE_SIZE_IN_BYTES;
+        }
+        else content = store_new_content(hash, page_addr);
+        tier = CONTENTS[content].tier;
     }
+    SWAP_OUTS[tier]++;
+
+    /* The previous copy of the page is stale */
+    if (SWAP_TABLE[slot].is_active && SWAP_TABLE[slot].content != -1) release_content(SWAP_TABLE[slot].content);
 
     SWAP_TABLE[slot].vaddr = page_addr;
-    SWAP_TABLE[slot].swap_offset = offset;
     SWAP_TABLE[slot].is_active = 1;
+    SWAP_TABLE[slot].tier = tier;
+    SWAP_TABLE[slot].content = content;
+    page->swap_slot = slot;
+    page->flags |= PAGE_SWAPPED;
 }
 
-int load_from_swap_if_exists(void *page_addr) {
-    for (int i = 0; i < MAX_SWAP_ENTRIES; i++) {
-        if (SWAP_TABLE[i].is_active && SWAP_TABLE[i].vaddr == page_addr) {
-            
-            if (lseek(SWAP_FD, SWAP_TABLE[i].swap_offset, SEEK_SET) == -1) return 0;
-            
-            if (read(SWAP_FD, page_addr, PAGE_SIZE_IN_BYTES) != PAGE_SIZE_IN_BYTES) {
-                perror("Swap read failed");
-                exit(1);
-            }
+/* Copies the swapped out content of the page at page_addr to destination, which is the page itself unless the
+ * page is installed afterwards (userfaultfd) */
+int load_from_swap_if_exists(void *page_addr, void *destination) {
+    PageDescriptor *page = get_page_descriptor(page_addr);
+    if (!page || !(page->flags & PAGE_SWAPPED)) return 0;    /* Not found in swap */
+    SwapEntry *entry = &SWAP_TABLE[page->swap_slot];
+    SWAP_INS[entry->tier]++;
 
-            return 1;    /* Found in swap */
-        }
+    /* The stored copy is kept, the slot has to stay valid while the page is clean */
+    if (entry->tier == SWAP_TIER_ZERO) {
+        memset(destination, 0, PAGE_SIZE_IN_BYTES);
+        BYTES_NOT_READ += PAGE_SIZE_IN_BYTES;
+    }
+    else if (entry->tier == SWAP_TIER_ZSWAP) {
+        zswap_load(CONTENTS[entry->content].zswap_handle, CONTENTS[entry->content].compressed_size, destination);
     }
-    return 0;    /* Not found in swap */ 
+    else read_content_from_disk(entry->content, destination);
+
+    return 1;    /* Found in swap */
+}
+
+void print_swap_stats() {
+    long outs = SWAP_OUTS[SWAP_TIER_DISK] + SWAP_OUTS[SWAP_TIER_ZSWAP] + SWAP_OUTS[SWAP_TIER_ZERO];
+    long ins = SWAP_INS[SWAP_TIER_DISK] + SWAP_INS[SWAP_TIER_ZSWAP] + SWAP_INS[SWAP_TIER_ZERO];
+
+    printf("Swap-outs: %ld (zswap %ld, disk %ld, zero %ld; %ld shared a stored duplicate)\n", outs,
+        SWAP_OUTS[SWAP_TIER_ZSWAP], SWAP_OUTS[SWAP_TIER_DISK], SWAP_OUTS[SWAP_TIER_ZERO], DUPLICATE_PAGES);
+    printf("Swap-ins: %ld (zswap hits %ld, %.1f%%; disk hits %ld, %.1f%%; zero %ld)\n", ins,
+        SWAP_INS[SWAP_TIER_ZSWAP], ins ? 100.0 * SWAP_INS[SWAP_TIER_ZSWAP] / ins : 0.0,
+        SWAP_INS[SWAP_TIER_DISK], ins ? 100.0 * SWAP_INS[SWAP_TIER_DISK] / ins : 0.0, SWAP_INS[SWAP_TIER_ZERO]);
+    long bytes_verified = VERIFICATION_READS * PAGE_SIZE_IN_BYTES;
+    printf("Swap I/O avoided: %ld bytes (%ld not written, %ld not read, less %ld read back to verify duplicates)\n",
+        BYTES_NOT_WRITTEN + BYTES_NOT_READ - bytes_verified, BYTES_NOT_WRITTEN, BYTES_NOT_READ, bytes_verified);
+    if (BACKEND) printf("Swap backend: %s\n", BACKEND->name);
+    if (BACKEND && BACKEND->print_stats) BACKEND->print_stats();
+    print_zswap_stats();
 }
 
 void cleanup_swap_system() {
+    if (BACKEND) BACKEND->cleanup();
+    cleanup_zswap();
     if (SWAP_TABLE) free(SWAP_TABLE);
+    if (FREE_SLOTS) free(FREE_SLOTS);
+    if (CONTENTS) free(CONTENTS);
+    if (FREE_CONTENTS) free(FREE_CONTENTS);
+    if (HASH_BUCKETS) free(HASH_BUCKETS);
     if (SWAP_FD != -1) {
         close(SWAP_FD);
         remove("swap.img");    /* Deleting the file */
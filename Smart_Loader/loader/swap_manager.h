@@ -7,17 +7,24 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
-/* Structure to track swapped pages */
+#define SWAP_TIER_DISK   0      /* Page stored in swap.img */
+#define SWAP_TIER_ZSWAP  1      /* Page stored compressed in the zswap pool */
+#define SWAP_TIER_ZERO   2      /* All-zero page, nothing stored */
+
+/* Structure to track swapped pages, identical pages share one stored copy */
 typedef struct SwapEntry {
     void *vaddr;            // Virtual address of the page
-    int swap_offset;        // Offset in the swap file
     int is_active;          // 1 if valid, 0 if empty
+    int tier;               // Where the page currently is (SWAP_TIER_*)
+    int content;            // Stored copy of the page, -1 for a zero page
 } SwapEntry;
 
 /* Public Function Prototypes */
 void init_swap_system(long max_pages);
 void handle_page_eviction_to_swap(void *page_addr);
-int load_from_swap_if_exists(void *page_addr);
+void begin_swap_in(void *page_addr);
+int load_from_swap_if_exists(void *page_addr, void *destination);
+void print_swap_stats();
 void cleanup_swap_system();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "swap_backend.h"
+
+/*
+ * io_uring backend of swap.img, driven with the raw syscalls. The staging frames and one read frame are a single
+ * registered buffer and the swap file a registered file, so requests are WRITE_FIXED/READ_FIXED on fixed file 0.
+ * Evictions copy their page into a frame, the staged writes are submitted 16 at a time in one io_uring_enter,
+ * sorted by block. A swap-in read is submitted as soon as the fault knows it needs the page and is only waited for
+ * after the victim has been evicted. Completions are reaped whenever the backend is called, everything runs in the
+ * SIGSEGV handler, no thread is involved.
+ *
+ * io_uring does not order requests, so a block released while its write is in flight and stored again does not have
+ * its new write submitted until the old one completed, or the stale page could land last.
+ */
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup    425
+#define __NR_io_uring_enter    426
+#define __NR_io_uring_register 427
+#endif
+
+#define URING_PAGE_SIZE        4096
+#define URING_ENTRIES          128     /* More than the requests that can be in flight at once */
+#define URING_FRAMES           64      /* Staging frames for writes */
+#define URING_BATCH            16      /* Staged writes submitted together */
+#define READ_FRAME             URING_FRAMES    /* Frame the early swap-in read goes to */
+#define READ_TAG               ((__u64)-1)     /* user_data of the read, writes carry their frame */
+
+#define FRAME_FREE             0
+#define FRAME_STAGED           1       /* Copied, not submitted yet */
+#define FRAME_IN_FLIGHT        2
+
+#define READ_IDLE              0
+#define READ_IN_FLIGHT         1
+#define READ_DONE              2
+
+/* Private Global Variables for the Ring */
+static int RING_FD = -1;
+static int SWAP_FD = -1;
+static void *SQ_RING = MAP_FAILED;
+static void *CQ_RING = MAP_FAILED;
+static size_t SQ_RING_SIZE = 0;
+static size_t CQ_RING_SIZE = 0;
+static struct io_uring_sqe *SQES = MAP_FAILED;
+static size_t SQES_SIZE = 0;
+
+static unsigned *SQ_TAIL, *SQ_MASK, *SQ_ARRAY;
+static unsigned *CQ_HEAD, *CQ_TAIL, *CQ_MASK;
+static struct io_uring_cqe *CQES;
+static unsigned TO_SUBMIT = 0;          /* Queued SQEs not passed to the kernel yet */
+
+/* Private Global Variables for the Frames */
+static unsigned char *FRAMES = MAP_FAILED;
+static int FRAME_STATE[URING_FRAMES];
+static int FRAME_BLOCK[URING_FRAMES];   /* Block the frame holds, -1 once released */
+static int *BLOCK_FRAME = NULL;         /* Frame holding each block, -1 if the block is on disk */
+static unsigned char *BLOCK_WRITING = NULL;     /* 1 while a write to the block is in flight */
+static int FRAME_TARGET[URING_FRAMES];  /* Block an in flight write goes to, kept when the block is released */
+static int FREE_FRAMES[URING_FRAMES];
+static int NUMBER_OF_FREE_FRAMES = 0;
+static int NUMBER_OF_STAGED = 0;
+static int WRITES_IN_FLIGHT = 0;
+
+static int READ_BLOCK = -1;             /* Block of the early read, -1 if released meanwhile */
+static int READ_STATE = READ_IDLE;
+
+static long STAGED_PAGES = 0;
+static long SUBMITTED_WRITES = 0;
+static long WRITE_BATCHES = 0;
+static long ENTER_CALLS = 0;
+static long SERVED_FROM_STAGING = 0;
+static long EARLY_READS = 0;
+static long EARLY_READS_READY = 0;      /* Early reads already complete when the page was needed */
+static long SYNC_READS = 0;
+static long CANCELLED_PAGES = 0;
+static long STALLS = 0;
+static long HELD_BACK_WRITES = 0;       /* Times a staged write waited for an older write to its block */
+
+
+/* Passes the queued SQEs to the kernel, waiting for min_complete completions */
+static void enter_ring(unsigned min_complete) {
+    if (TO_SUBMIT == 0 && min_complete == 0) return;
+
+    long submitted;
+    do {
+        submitted = syscall(__NR_io_uring_enter, RING_FD, TO_SUBMIT, min_complete,
+                            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (submitted == -1 && errno == EINTR);
+    if (submitted == -1) {perror("io_uring_enter failed"); _exit(1);}
+
+    ENTER_CALLS++;
+    TO_SUBMIT -= (unsigned)submitted;
+}
+
+
+static void queue_request(int opcode, int frame, int block, __u64 user_data) {
+    unsigned tail = *SQ_TAIL;
+    unsigned idx = tail & *SQ_MASK;
+    struct io_uring_sqe *sqe = &SQES[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (__u8)opcode;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (unsigned long)(FRAMES + (long)frame * URING_PAGE_SIZE);
+    sqe->len = URING_PAGE_SIZE;
+    sqe->off = (__u64)block * URING_PAGE_SIZE;
+    sqe->buf_index = 0;
+    sqe->user_data = user_data;
+
+    SQ_ARRAY[idx] = idx;
+    __atomic_store_n(SQ_TAIL, tail + 1, __ATOMIC_RELEASE);
+    TO_SUBMIT++;
+}
+
+
+static void reap_completions() {
+    unsigned head = *CQ_HEAD;
+    unsigned tail = __atomic_load_n(CQ_TAIL, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &CQES[head & *CQ_MASK];
+        if (cqe->res != URING_PAGE_SIZE) {
+            char msg[] = "Swap io_uring request failed\n";
+            write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+            _exit(1);
+        }
+
+        if (cqe->user_data == READ_TAG) {
+            READ_STATE = READ_DONE;
+            continue;
+        }
+
+        int f = (int)cqe->user_data;
+        BLOCK_WRITING[FRAME_TARGET[f]] = 0;
+        if (FRAME_BLOCK[f] != -1) BLOCK_FRAME[FRAME_BLOCK[f]] = -1;
+        FRAME_STATE[f] = FRAME_FREE;
+        FREE_FRAMES[NUMBER_OF_FREE_FRAMES++] = f;
+        WRITES_IN_FLIGHT--;
+    }
+    __atomic_store_n(CQ_HEAD, head, __ATOMIC_RELEASE);
+}
+
+
+static int compare_frames_by_block(const void *a, const void *b) {
+    return FRAME_BLOCK[*(const int *)a] - FRAME_BLOCK[*(const int *)b];
+}
+
+
+/* Queues the staged frames in block order, the caller enters the ring. A frame whose block still has a write in
+ * flight stays staged for a later batch. */
+static void queue_staged_writes() {
+    int frames[URING_FRAMES];
+    int count = 0;
+
+    for (int f = 0; f < URING_FRAMES; f++) {
+        if (FRAME_STATE[f] != FRAME_STAGED) continue;
+        if (BLOCK_WRITING[FRAME_BLOCK[f]]) HELD_BACK_WRITES++;
+        else frames[count++] = f;
+    }
+    qsort(frames, count, sizeof(int), compare_frames_by_block);
+
+    for (int i = 0; i < count; i++) {
+        queue_request(IORING_OP_WRITE_FIXED, frames[i], FRAME_BLOCK[frames[i]], (__u64)frames[i]);
+        FRAME_STATE[frames[i]] = FRAME_IN_FLIGHT;
+        FRAME_TARGET[frames[i]] = FRAME_BLOCK[frames[i]];
+        BLOCK_WRITING[FRAME_BLOCK[frames[i]]] = 1;
+    }
+    NUMBER_OF_STAGED -= count;
+    WRITES_IN_FLIGHT += count;
+    SUBMITTED_WRITES += count;
+    if (count) WRITE_BATCHES++;
+}
+
+
+static void wait_for_early_read() {
+    while (READ_STATE == READ_IN_FLIGHT) {
+        enter_ring(1);
+        reap_completions();
+    }
+}
+
+
+static int uring_init(int fd, int number_of_blocks) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    RING_FD = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (RING_FD == -1) return 0;
+    SWAP_FD = fd;
+
+    /* Mapping the rings, a single mapping holds both when the kernel supports it */
+    SQ_RING_SIZE = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    CQ_RING_SIZE = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (CQ_RING_SIZE > SQ_RING_SIZE) SQ_RING_SIZE = CQ_RING_SIZE;
+        CQ_RING_SIZE = 0;
+    }
+
+    SQ_RING = mmap(NULL, SQ_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING_FD, IORING_OFF_SQ_RING);
+    if (SQ_RING == MAP_FAILED) return 0;
+    CQ_RING = SQ_RING;
+    if (CQ_RING_SIZE) {
+        CQ_RING = mmap(NULL, CQ_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING_FD, IORING_OFF_CQ_RING);
+        if (CQ_RING == MAP_FAILED) return 0;
+    }
+    SQES_SIZE = params.sq_entries * sizeof(struct io_uring_sqe);
+    SQES = (struct io_uring_sqe *) mmap(NULL, SQES_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING_FD, IORING_OFF_SQES);
+    if (SQES == MAP_FAILED) return 0;
+
+    SQ_TAIL = (unsigned *)((char *)SQ_RING + params.sq_off.tail);
+    SQ_MASK = (unsigned *)((char *)SQ_RING + params.sq_off.ring_mask);
+    SQ_ARRAY = (unsigned *)((char *)SQ_RING + params.sq_off.array);
+    CQ_HEAD = (unsigned *)((char *)CQ_RING + params.cq_off.head);
+    CQ_TAIL = (unsigned *)((char *)CQ_RING + params.cq_off.tail);
+    CQ_MASK = (unsigned *)((char *)CQ_RING + params.cq_off.ring_mask);
+    CQES = (struct io_uring_cqe *)((char *)CQ_RING + params.cq_off.cqes);
+
+    /* Registering the frames as one fixed buffer and the swap file as fixed file 0 */
+    FRAMES = (unsigned char *) mmap(NULL, (long)(URING_FRAMES + 1) * URING_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (FRAMES == MAP_FAILED) return 0;
+
+    struct iovec buffer = {FRAMES, (size_t)(URING_FRAMES + 1) * URING_PAGE_SIZE};
+    if (syscall(__NR_io_uring_register, RING_FD, IORING_REGISTER_BUFFERS, &buffer, 1) == -1) return 0;
+    if (syscall(__NR_io_uring_register, RING_FD, IORING_REGISTER_FILES, &fd, 1) == -1) return 0;
+
+    BLOCK_FRAME = (int *) malloc(number_of_blocks * sizeof(int));
+    BLOCK_WRITING = (unsigned char *) calloc(number_of_blocks, 1);
+    if (!BLOCK_FRAME || !BLOCK_WRITING) {printf("Memory Allocation for io_uring backend failed\n"); exit(2);}
+
+    for (int b = 0; b < number_of_blocks; b++) BLOCK_FRAME[b] = -1;
+    for (int f = 0; f < URING_FRAMES; f++) {
+        FRAME_STATE[f] = FRAME_FREE;
+        FRAME_BLOCK[f] = -1;
+        FREE_FRAMES[f] = URING_FRAMES - 1 - f;
+    }
+    NUMBER_OF_FREE_FRAMES = URING_FRAMES;
+    return 1;
+}
+
+
+static void uring_write_block(int block, const void *page_addr) {
+    reap_completions();
+    if (NUMBER_OF_FREE_FRAMES == 0) {
+        STALLS++;
+        /* Held back frames are queued again once the write they wait for completed */
+        while (NUMBER_OF_FREE_FRAMES == 0) {
+            queue_staged_writes();
+            enter_ring(1);
+            reap_completions();
+        }
+    }
+
+    int f = FREE_FRAMES[--NUMBER_OF_FREE_FRAMES];
+    memcpy(FRAMES + (long)f * URING_PAGE_SIZE, page_addr, URING_PAGE_SIZE);
+    FRAME_STATE[f] = FRAME_STAGED;
+    FRAME_BLOCK[f] = block;
+    BLOCK_FRAME[block] = f;
+    STAGED_PAGES++;
+
+    if (++NUMBER_OF_STAGED >= URING_BATCH) {
+        queue_staged_writes();
+        enter_ring(0);
+    }
+}
+
+
+/* The staged writes are left to fill their batch */
+static void uring_begin_read(int block) {
+    reap_completions();
+    if (BLOCK_FRAME[block] != -1) return;    /* Served from its frame */
+
+    wait_for_early_read();
+    READ_BLOCK = block;
+    READ_STATE = READ_IN_FLIGHT;
+    queue_request(IORING_OP_READ_FIXED, READ_FRAME, block, READ_TAG);
+    enter_ring(0);
+    EARLY_READS++;
+}
+
+
+static void uring_read_block(int block, void *page_addr) {
+    reap_completions();
+
+    int f = BLOCK_FRAME[block];
+    if (f != -1) {
+        memcpy(page_addr, FRAMES + (long)f * URING_PAGE_SIZE, URING_PAGE_SIZE);
+        SERVED_FROM_STAGING++;
+        return;
+    }
+
+    if (READ_BLOCK == block && READ_STATE != READ_IDLE) {
+        if (READ_STATE == READ_DONE) EARLY_READS_READY++;
+        wait_for_early_read();
+        memcpy(page_addr, FRAMES + (long)READ_FRAME * URING_PAGE_SIZE, URING_PAGE_SIZE);
+        READ_STATE = READ_IDLE;
+        READ_BLOCK = -1;
+        return;
+    }
+
+    /* Not announced (verification of a duplicate), read at once */
+    SYNC_READS++;
+    if (pread(SWAP_FD, page_addr, URING_PAGE_SIZE, (off_t)block * URING_PAGE_SIZE) != URING_PAGE_SIZE) {
+        perror("Swap read failed");
+        exit(1);
+    }
+}
+
+
+static void uring_release_block(int block) {
+    if (READ_BLOCK == block) READ_BLOCK = -1;
+
+    int f = BLOCK_FRAME[block];
+    if (f == -1) return;
+    BLOCK_FRAME[block] = -1;
+    FRAME_BLOCK[f] = -1;
+
+    /* A frame already submitted is freed by its completion */
+    if (FRAME_STATE[f] == FRAME_STAGED) {
+        FRAME_STATE[f] = FRAME_FREE;
+        FREE_FRAMES[NUMBER_OF_FREE_FRAMES++] = f;
+        NUMBER_OF_STAGED--;
+        CANCELLED_PAGES++;
+    }
+}
+
+
+static void uring_print_stats() {
+    printf("io_uring: %ld pages staged, %ld writes submitted in %ld batches (%.1f per batch), %ld io_uring_enter calls\n",
+        STAGED_PAGES, SUBMITTED_WRITES, WRITE_BATCHES, WRITE_BATCHES ? (double)SUBMITTED_WRITES / WRITE_BATCHES : 0.0, ENTER_CALLS);
+    printf("io_uring: %ld swap-ins served from staging, %ld reads started early (%ld complete when needed), %ld synchronous reads\n",
+        SERVED_FROM_STAGING, EARLY_READS, EARLY_READS_READY, SYNC_READS);
+    printf("io_uring: %ld staged pages dropped unwritten, %ld evictions waited for a frame, %ld writes held back behind an older one\n",
+        CANCELLED_PAGES, STALLS, HELD_BACK_WRITES);
+}
+
+
+/* The kernel may still write into the frames, so in flight requests complete before anything is unmapped */
+static void uring_cleanup() {
+    if (RING_FD != -1 && BLOCK_FRAME) {
+        wait_for_early_read();
+        while (WRITES_IN_FLIGHT > 0) {
+            enter_ring(1);
+            reap_completions();
+        }
+    }
+
+    if (SQES != MAP_FAILED) munmap(SQES, SQES_SIZE);
+    if (CQ_RING != MAP_FAILED && CQ_RING != SQ_RING) munmap(CQ_RING, CQ_RING_SIZE);
+    if (SQ_RING != MAP_FAILED) munmap(SQ_RING, SQ_RING_SIZE);
+    if (RING_FD != -1) close(RING_FD);
+    if (FRAMES != MAP_FAILED) munmap(FRAMES, (long)(URING_FRAMES + 1) * URING_PAGE_SIZE);
+    free(BLOCK_FRAME);
+    free(BLOCK_WRITING);
+
+    SQES = MAP_FAILED;
+    SQ_RING = CQ_RING = MAP_FAILED;
+    FRAMES = MAP_FAILED;
+    RING_FD = -1;
+    BLOCK_FRAME = NULL;
+    BLOCK_WRITING = NULL;
+}
+
+
+const SwapBackend URING_SWAP_BACKEND = {
+    "uring", uring_init, uring_write_block, uring_begin_read, uring_read_block, uring_release_block, uring_print_stats, uring_cleanup
+};
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+#include "userfault.h"
+
+#define USERFAULT_PAGE_SIZE    4096
+#define MAX_USERFAULT_RANGES   16
+
+/* Private Global Variables for userfaultfd */
+static int UFFD = -1;
+static int STOP_PIPE[2] = {-1, -1};     /* Written once to end the thread */
+static pthread_t THREAD;
+static int THREAD_RUNNING = 0;
+static void (*RESOLVE_FAULT)(void *fault_addr, int is_write) = NULL;
+
+static unsigned long RANGE_START[MAX_USERFAULT_RANGES];
+static unsigned long RANGE_LENGTH[MAX_USERFAULT_RANGES];
+static int NUMBER_OF_RANGES = 0;
+
+static long RESOLVED_FAULTS = 0;
+static long COPIED_PAGES = 0;
+static long ZERO_PAGES = 0;
+
+
+static void wake_range(unsigned long page_start) {
+    struct uffdio_range range = {page_start, USERFAULT_PAGE_SIZE};
+    if (ioctl(UFFD, UFFDIO_WAKE, &range) == -1) {
+        perror("UFFDIO_WAKE failed");
+        _exit(1);
+    }
+}
+
+
+/*
+ * The guest is single threaded and sleeps while its fault is resolved, so the thread and the SIGSEGV handler never
+ * run the loader at the same time. The ioctl that wakes the guest orders the loader's updates before its return.
+ */
+static void *userfault_thread(void *unused) {
+    (void)unused;
+    struct pollfd fds[2] = {{UFFD, POLLIN, 0}, {STOP_PIPE[0], POLLIN, 0}};
+
+    while (1) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("userfaultfd poll failed");
+            _exit(1);
+        }
+        if (fds[1].revents) break;
+
+        struct uffd_msg msg;
+        ssize_t bytes_read = read(UFFD, &msg, sizeof(msg));
+        if (bytes_read == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (bytes_read != sizeof(msg)) {
+            perror("userfaultfd read failed");
+            _exit(1);
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT) continue;
+
+        unsigned long page_start = (unsigned long)msg.arg.pagefault.address & ~(unsigned long)(USERFAULT_PAGE_SIZE - 1);
+        RESOLVE_FAULT((void *)(unsigned long)msg.arg.pagefault.address, (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) != 0);
+        RESOLVED_FAULTS++;
+        wake_range(page_start);
+    }
+    return NULL;
+}
+
+
+int start_userfault_handler(void (*resolve_fault)(void *fault_addr, int is_write)) {
+    /* Faults of the kernel itself are not needed, which lets unprivileged processes use it */
+    UFFD = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (UFFD == -1) UFFD = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (UFFD == -1) return 0;
+
+    struct uffdio_api api = {UFFD_API, 0, 0};
+    if (ioctl(UFFD, UFFDIO_API, &api) == -1 || pipe(STOP_PIPE) == -1) {
+        close(UFFD);
+        UFFD = -1;
+        return 0;
+    }
+
+    RESOLVE_FAULT = resolve_fault;
+    if (pthread_create(&THREAD, NULL, userfault_thread, NULL) != 0) {printf("Failed to start the userfaultfd thread\n"); exit(2);}
+    THREAD_RUNNING = 1;
+    return 1;
+}
+
+
+int register_userfault_range(unsigned long start, unsigned long length) {
+    if (NUMBER_OF_RANGES == MAX_USERFAULT_RANGES) return 0;
+
+    void *area = mmap((void *)start, length, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (area == MAP_FAILED) return 0;
+
+    RANGE_START[NUMBER_OF_RANGES] = start;
+    RANGE_LENGTH[NUMBER_OF_RANGES] = length;
+    NUMBER_OF_RANGES++;
+
+    struct uffdio_register reg = {{start, length}, UFFDIO_REGISTER_MODE_MISSING, 0};
+    return ioctl(UFFD, UFFDIO_REGISTER, &reg) != -1;
+}
+
+
+int userfault_enabled() {
+    return THREAD_RUNNING;
+}
+
+
+void userfault_copy(unsigned long page_start, const void *content) {
+    struct uffdio_copy copy = {page_start, (unsigned long)content, USERFAULT_PAGE_SIZE, UFFDIO_COPY_MODE_DONTWAKE, 0};
+    if (ioctl(UFFD, UFFDIO_COPY, &copy) == -1) {
+        perror("UFFDIO_COPY failed");
+        _exit(1);
+    }
+    COPIED_PAGES++;
+}
+
+
+void userfault_zero(unsigned long page_start) {
+    struct uffdio_zeropage zero = {{page_start, USERFAULT_PAGE_SIZE}, UFFDIO_ZEROPAGE_MODE_DONTWAKE, 0};
+    if (ioctl(UFFD, UFFDIO_ZEROPAGE, &zero) == -1) {
+        perror("UFFDIO_ZEROPAGE failed");
+        _exit(1);
+    }
+    ZERO_PAGES++;
+}
+
+
+void print_userfault_stats() {
+    if (!THREAD_RUNNING) return;
+    printf("userfaultfd: %ld faults resolved by the handler thread, %ld pages copied in, %ld zero pages\n",
+        RESOLVED_FAULTS, COPIED_PAGES, ZERO_PAGES);
+}
+
+
+void stop_userfault_handler() {
+    if (THREAD_RUNNING) {
+        char stop = 1;
+        write(STOP_PIPE[1], &stop, 1);
+        pthread_join(THREAD, NULL);
+        THREAD_RUNNING = 0;
+    }
+
+    for (int i = 0; i < NUMBER_OF_RANGES; i++) munmap((void *)RANGE_START[i], RANGE_LENGTH[i]);
+    NUMBER_OF_RANGES = 0;
+
+    if (UFFD != -1) close(UFFD);
+    if (STOP_PIPE[0] != -1) close(STOP_PIPE[0]);
+    if (STOP_PIPE[1] != -1) close(STOP_PIPE[1]);
+    UFFD = -1;
+    STOP_PIPE[0] = STOP_PIPE[1] = -1;
+}
@@ -0,0 +1,28 @@
+#ifndef USERFAULT_H
+#define USERFAULT_H
+
+/*
+ * userfaultfd demand paging. The PT_LOAD ranges are mapped anonymous up front and registered for missing page
+ * faults, which the kernel reports to a handler thread instead of raising SIGSEGV. The thread hands each missing
+ * page to the loader and wakes the guest once the loader has filled it with UFFDIO_COPY or UFFDIO_ZEROPAGE.
+ * Protection faults (reference and dirty tracking) are still signals.
+ */
+
+/* Creates the userfaultfd and the handler thread, returns 0 if the kernel does not allow it */
+int start_userfault_handler(void (*resolve_fault)(void *fault_addr, int is_write));
+
+/* Maps the range anonymous and registers it, returns 0 on failure */
+int register_userfault_range(unsigned long start, unsigned long length);
+
+int userfault_enabled();
+
+/* Install a page without waking the faulting thread, so the loader can finish its bookkeeping first */
+void userfault_copy(unsigned long page_start, const void *content);
+void userfault_zero(unsigned long page_start);
+
+void print_userfault_stats();
+
+/* Stops the thread and unmaps the registered ranges */
+void stop_userfault_handler();
+
+#endif
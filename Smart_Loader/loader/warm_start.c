@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "warm_start.h"
+
+/* Private Global Variables for the Warm Start */
+static const char *PROFILE_PATH = NULL;
+static unsigned long ENTRY = 0;
+static unsigned long FIRST_PAGE_NUMBER = 0;
+static unsigned long NUMBER_OF_PAGES = 0;
+
+static uint32_t *PROFILE_PAGES = NULL;      /* Loaded profile */
+static long NUMBER_OF_PROFILE_PAGES = 0;
+static uint32_t COLD_PAGE_FAULTS = 0;
+static uint32_t COLD_MAX_PAGES = 0;
+static int PROFILE_LOADED = 0;
+
+static uint32_t *FIRST_TOUCH = NULL;        /* Per page, order in which it first became resident, 0 if never */
+static uint32_t NEXT_TOUCH = 1;
+
+static uint32_t *SAVED_PAGES = NULL;        /* Resident pages collected at exit */
+static long NUMBER_OF_SAVED_PAGES = 0;
+
+
+
+
+void init_warm_start(const char *path, unsigned long entry, unsigned long first_page_number, unsigned long number_of_pages) {
+    PROFILE_PATH = path;
+    ENTRY = entry;
+    FIRST_PAGE_NUMBER = first_page_number;
+    NUMBER_OF_PAGES = number_of_pages;
+
+    FIRST_TOUCH = (uint32_t *) calloc(number_of_pages, sizeof(uint32_t));
+    SAVED_PAGES = (uint32_t *) malloc(number_of_pages * sizeof(uint32_t));
+    PROFILE_PAGES = (uint32_t *) malloc(number_of_pages * sizeof(uint32_t));
+    if (!FIRST_TOUCH || !SAVED_PAGES || !PROFILE_PAGES) {printf("Memory Allocation for warm start failed\n"); exit(2);}
+
+    FILE *profile = fopen(path, "rb");
+    if (!profile) return;       /* Cold run, the profile is created at exit */
+
+    WarmStartHeader header;
+    if (fread(&header, sizeof(header), 1, profile) != 1 || memcmp(header.magic, WARM_START_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != WARM_START_VERSION || header.entry != entry || header.first_page_number != first_page_number ||
+        header.number_of_pages != number_of_pages || header.number_of_pages_in_profile > number_of_pages ||
+        fread(PROFILE_PAGES, sizeof(uint32_t), header.number_of_pages_in_profile, profile) != header.number_of_pages_in_profile) {
+        printf("Warm start profile %s does not match the executable, starting cold\n", path);
+        fclose(profile);
+        return;
+    }
+    fclose(profile);
+
+    NUMBER_OF_PROFILE_PAGES = header.number_of_pages_in_profile;
+    COLD_PAGE_FAULTS = header.cold_page_faults;
+    COLD_MAX_PAGES = header.cold_max_pages;
+    PROFILE_LOADED = 1;
+}
+
+
+long warm_start_profile(const uint32_t **pages) {
+    *pages = PROFILE_PAGES;
+    return NUMBER_OF_PROFILE_PAGES;
+}
+
+
+/* Called from the fault handlers, only touches preallocated memory */
+void record_first_touch(unsigned long page_number) {
+    if (!FIRST_TOUCH) return;
+
+    uint32_t *touch = &FIRST_TOUCH[page_number - FIRST_PAGE_NUMBER];
+    if (*touch == 0) *touch = NEXT_TOUCH++;
+}
+
+
+void add_to_warm_start_profile(unsigned long page_number, void *ctx) {
+    SAVED_PAGES[NUMBER_OF_SAVED_PAGES++] = (uint32_t)page_number;
+}
+
+
+static int compare_first_touch(const void *a, const void *b) {
+    uint32_t touch_a = FIRST_TOUCH[*(const uint32_t *)a - FIRST_PAGE_NUMBER];
+    uint32_t touch_b = FIRST_TOUCH[*(const uint32_t *)b - FIRST_PAGE_NUMBER];
+    return (touch_a > touch_b) - (touch_a < touch_b);
+}
+
+
+void save_warm_start_profile(long page_faults, long max_pages) {
+    if (!FIRST_TOUCH) return;
+
+    qsort(SAVED_PAGES, NUMBER_OF_SAVED_PAGES, sizeof(uint32_t), compare_first_touch);
+
+    WarmStartHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WARM_START_MAGIC, sizeof(header.magic));
+    header.version = WARM_START_VERSION;
+    header.entry = (uint32_t)ENTRY;
+    header.first_page_number = (uint32_t)FIRST_PAGE_NUMBER;
+    header.number_of_pages = (uint32_t)NUMBER_OF_PAGES;
+    header.number_of_pages_in_profile = (uint32_t)NUMBER_OF_SAVED_PAGES;
+    header.cold_page_faults = PROFILE_LOADED ? COLD_PAGE_FAULTS : (uint32_t)page_faults;
+    header.cold_max_pages = PROFILE_LOADED ? COLD_MAX_PAGES : (uint32_t)max_pages;
+
+    FILE *profile = fopen(PROFILE_PATH, "wb");
+    if (!profile) {perror("Failed to write warm start profile"); return;}
+    if (fwrite(&header, sizeof(header), 1, profile) != 1 ||
+        fwrite(SAVED_PAGES, sizeof(uint32_t), NUMBER_OF_SAVED_PAGES, profile) != (size_t)NUMBER_OF_SAVED_PAGES) {
+        perror("Failed to write warm start profile");
+    }
+    fclose(profile);
+}
+
+
+void print_warm_start_stats(long prefaulted_pages, long page_faults, long max_pages) {
+    if (!FIRST_TOUCH) return;
+
+    if (!PROFILE_LOADED) {
+        printf("Warm start: no profile loaded, %ld resident pages saved to %s\n", NUMBER_OF_SAVED_PAGES, PROFILE_PATH);
+        return;
+    }
+
+    printf("Warm start: %ld of %ld profiled pages prefaulted, %ld page faults against %u in the cold run (%ld avoided)%s\n",
+        prefaulted_pages, NUMBER_OF_PROFILE_PAGES, page_faults, COLD_PAGE_FAULTS, (long)COLD_PAGE_FAULTS - page_faults,
+        COLD_MAX_PAGES == max_pages ? "" : ", the cold run had another budget");
+}
+
+
+void cleanup_warm_start() {
+    free(FIRST_TOUCH);
+    free(SAVED_PAGES);
+    free(PROFILE_PAGES);
+    FIRST_TOUCH = SAVED_PAGES = PROFILE_PAGES = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef WARM_START_H
+#define WARM_START_H
+
+#include <stdint.h>
+
+/*
+ * Warm-start profile: a WarmStartHeader followed by number_of_pages_in_profile uint32_t page numbers, the resident
+ * set at the end of a run in the order its pages first became resident. A later run of the same executable loads
+ * them before jumping to e_entry instead of faulting them in one by one.
+ *
+ * The profile keeps the page faults and the budget of the run that had no profile yet, carried over by every run
+ * that rewrites it, so warm runs can report the faults they avoided. All fields are little endian.
+ */
+
+#define WARM_START_MAGIC        "SLWARMST"
+#define WARM_START_VERSION      1
+
+typedef struct WarmStartHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry;                 /* e_entry of the executable, with the page range it identifies the layout */
+    uint32_t first_page_number;
+    uint32_t number_of_pages;
+    uint32_t number_of_pages_in_profile;
+    uint32_t cold_page_faults;      /* Page faults of the run without a profile */
+    uint32_t cold_max_pages;        /* Budget of that run */
+    uint32_t reserved;
+} WarmStartHeader;
+
+
+/* Loads the profile at path if it exists and matches the executable, the profile is rewritten there at exit */
+void init_warm_start(const char *path, unsigned long entry, unsigned long first_page_number, unsigned long number_of_pages);
+
+/* Pages of the loaded profile in first touch order, 0 if there is none */
+long warm_start_profile(const uint32_t **pages);
+
+/* A page became resident, only its first time counts */
+void record_first_touch(unsigned long page_number);
+
+/* Adds a resident page to the profile being saved, a callback for ReplacementPolicy.iterate_resident */
+void add_to_warm_start_profile(unsigned long page_number, void *ctx);
+
+/* Writes the pages added, in first touch order */
+void save_warm_start_profile(long page_faults, long max_pages);
+
+void print_warm_start_stats(long prefaulted_pages, long page_faults, long max_pages);
+
+void cleanup_warm_start();
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "swap_backend.h"
+
+#define WRITEBACK_PAGE_SIZE    4096
+#define STAGING_FRAMES         64      /* 256 KiB of pages waiting for the disk */
+#define WRITEBACK_BATCH        16      /* Staged pages that wake the thread at once */
+#define WRITEBACK_DELAY_MS     5       /* Otherwise the thread drains what is staged this long after the first page */
+
+#define FRAME_FREE             0
+#define FRAME_PENDING          1       /* Staged, not picked up yet */
+#define FRAME_WRITING          2       /* In a pwritev, still readable */
+
+/*
+ * Asynchronous writeback of swap.img. An eviction copies its page into a frame of a staging buffer and returns, a
+ * background thread sorts the staged pages by block, coalesces adjacent blocks and writes each run with one pwritev.
+ * A page is served from its frame until its write has completed, so a fault never waits on a write it caused.
+ * The eviction only blocks when every frame is still waiting for the disk.
+ *
+ * The SIGSEGV handler and the thread share the tables under one mutex, which is never held during I/O. The handler
+ * only runs on faults of guest code, which can not hold the mutex, so taking it there can not deadlock.
+ */
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t WORK_AVAILABLE = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t FRAME_FREED = PTHREAD_COND_INITIALIZER;
+static pthread_t THREAD;
+static int THREAD_RUNNING = 0;
+static int SHUTTING_DOWN = 0;
+
+/* Private Global Variables for Writeback */
+static int SWAP_FD = -1;
+static unsigned char *STAGING = NULL;
+static int FRAME_STATE[STAGING_FRAMES];
+static int FRAME_BLOCK[STAGING_FRAMES];         /* Block the frame holds, -1 once cancelled */
+static int *BLOCK_FRAME = NULL;                 /* Frame holding each block, -1 if the block is on disk */
+
+static int FREE_FRAMES[STAGING_FRAMES];
+static int NUMBER_OF_FREE_FRAMES = 0;
+static int NUMBER_OF_PENDING = 0;
+
+static long STAGED_PAGES = 0;
+static long WRITTEN_PAGES = 0;
+static long WRITE_CALLS = 0;
+static long LONGEST_RUN = 0;
+static long SERVED_FROM_STAGING = 0;
+static long CANCELLED_PAGES = 0;
+static long STALLS = 0;                         /* Evictions that waited for a free frame */
+
+
+/* A frame picked up by the thread, with its block copied since a cancellation may clear FRAME_BLOCK meanwhile */
+typedef struct StagedPage {
+    int frame;
+    int block;
+} StagedPage;
+
+
+static int compare_by_block(const void *a, const void *b) {
+    return ((const StagedPage *)a)->block - ((const StagedPage *)b)->block;
+}
+
+
+/* Writes the pages, already sorted by block, as runs of adjacent blocks */
+static void write_pages(const StagedPage *pages, int count) {
+    struct iovec iov[STAGING_FRAMES];
+
+    for (int start = 0; start < count; ) {
+        int end = start + 1;
+        while (end < count && pages[end].block == pages[end - 1].block + 1) end++;
+
+        for (int i = start; i < end; i++) {
+            iov[i - start].iov_base = STAGING + (long)pages[i].frame * WRITEBACK_PAGE_SIZE;
+            iov[i - start].iov_len = WRITEBACK_PAGE_SIZE;
+        }
+
+        ssize_t expected = (ssize_t)(end - start) * WRITEBACK_PAGE_SIZE;
+        if (pwritev(SWAP_FD, iov, end - start, (off_t)pages[start].block * WRITEBACK_PAGE_SIZE) != expected) {
+            perror("Swap writeback failed");
+            _exit(1);
+        }
+
+        WRITE_CALLS++;
+        WRITTEN_PAGES += end - start;
+        if (end - start > LONGEST_RUN) LONGEST_RUN = end - start;
+        start = end;
+    }
+}
+
+
+static void *writeback_thread(void *unused) {
+    (void)unused;
+    StagedPage batch[STAGING_FRAMES];
+
+    pthread_mutex_lock(&LOCK);
+    while (!SHUTTING_DOWN) {
+        /* Nothing staged, sleep until the first page arms the deadline instead of waking every WRITEBACK_DELAY_MS */
+        if (NUMBER_OF_PENDING == 0) {
+            pthread_cond_wait(&WORK_AVAILABLE, &LOCK);
+            continue;
+        }
+
+        if (NUMBER_OF_PENDING < WRITEBACK_BATCH) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WRITEBACK_DELAY_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {deadline.tv_sec++; deadline.tv_nsec -= 1000000000L;}
+            pthread_cond_timedwait(&WORK_AVAILABLE, &LOCK, &deadline);
+            if (SHUTTING_DOWN || NUMBER_OF_PENDING == 0) continue;
+        }
+
+        int count = 0;
+        for (int f = 0; f < STAGING_FRAMES; f++) {
+            if (FRAME_STATE[f] != FRAME_PENDING) continue;
+            FRAME_STATE[f] = FRAME_WRITING;
+            batch[count].frame = f;
+            batch[count++].block = FRAME_BLOCK[f];
+        }
+        NUMBER_OF_PENDING = 0;
+        pthread_mutex_unlock(&LOCK);
+
+        qsort(batch, count, sizeof(StagedPage), compare_by_block);
+        write_pages(batch, count);
+
+        pthread_mutex_lock(&LOCK);
+        for (int i = 0; i < count; i++) {
+            int f = batch[i].frame;
+            if (FRAME_BLOCK[f] != -1) BLOCK_FRAME[FRAME_BLOCK[f]] = -1;
+            FRAME_STATE[f] = FRAME_FREE;
+            FREE_FRAMES[NUMBER_OF_FREE_FRAMES++] = f;
+        }
+        pthread_cond_broadcast(&FRAME_FREED);
+    }
+    pthread_mutex_unlock(&LOCK);
+    return NULL;
+}
+
+
+static int init_writeback(int fd, int number_of_blocks) {
+    SWAP_FD = fd;
+
+    STAGING = (unsigned char *) malloc((long)STAGING_FRAMES * WRITEBACK_PAGE_SIZE);
+    BLOCK_FRAME = (int *) malloc(number_of_blocks * sizeof(int));
+    if (!STAGING || !BLOCK_FRAME) {printf("Memory Allocation for writeback failed\n"); exit(2);}
+
+    for (int b = 0; b < number_of_blocks; b++) BLOCK_FRAME[b] = -1;
+    for (int f = 0; f < STAGING_FRAMES; f++) {
+        FRAME_STATE[f] = FRAME_FREE;
+        FRAME_BLOCK[f] = -1;
+        FREE_FRAMES[f] = STAGING_FRAMES - 1 - f;
+    }
+    NUMBER_OF_FREE_FRAMES = STAGING_FRAMES;
+
+    if (pthread_create(&THREAD, NULL, writeback_thread, NULL) != 0) {printf("Failed to start the writeback thread\n"); exit(2);}
+    THREAD_RUNNING = 1;
+    return 1;
+}
+
+
+static void writeback_stage(int block, const void *page_addr) {
+    pthread_mutex_lock(&LOCK);
+    if (NUMBER_OF_FREE_FRAMES == 0) {
+        STALLS++;
+        pthread_cond_signal(&WORK_AVAILABLE);
+        while (NUMBER_OF_FREE_FRAMES == 0) pthread_cond_wait(&FRAME_FREED, &LOCK);
+    }
+
+    int f = FREE_FRAMES[--NUMBER_OF_FREE_FRAMES];
+    memcpy(STAGING + (long)f * WRITEBACK_PAGE_SIZE, page_addr, WRITEBACK_PAGE_SIZE);
+    FRAME_STATE[f] = FRAME_PENDING;
+    FRAME_BLOCK[f] = block;
+    BLOCK_FRAME[block] = f;
+    STAGED_PAGES++;
+
+    if (++NUMBER_OF_PENDING == 1 || NUMBER_OF_PENDING >= WRITEBACK_BATCH) pthread_cond_signal(&WORK_AVAILABLE);
+    pthread_mutex_unlock(&LOCK);
+}
+
+
+/* A block whose write has completed is no longer in BLOCK_FRAME, so reading the file after the check is safe */
+static void writeback_read(int block, void *page_addr) {
+    pthread_mutex_lock(&LOCK);
+    int f = BLOCK_FRAME[block];
+    if (f != -1) {
+        memcpy(page_addr, STAGING + (long)f * WRITEBACK_PAGE_SIZE, WRITEBACK_PAGE_SIZE);
+        SERVED_FROM_STAGING++;
+    }
+    pthread_mutex_unlock(&LOCK);
+    if (f != -1) return;
+
+    if (pread(SWAP_FD, page_addr, WRITEBACK_PAGE_SIZE, (off_t)block * WRITEBACK_PAGE_SIZE) != WRITEBACK_PAGE_SIZE) {
+        perror("Swap read failed");
+        exit(1);
+    }
+}
+
+
+static void writeback_cancel(int block) {
+    pthread_mutex_lock(&LOCK);
+    int f = BLOCK_FRAME[block];
+    if (f != -1) {
+        BLOCK_FRAME[block] = -1;
+        FRAME_BLOCK[f] = -1;
+
+        /* A frame already being written is freed by the thread */
+        if (FRAME_STATE[f] == FRAME_PENDING) {
+            FRAME_STATE[f] = FRAME_FREE;
+            FREE_FRAMES[NUMBER_OF_FREE_FRAMES++] = f;
+            NUMBER_OF_PENDING--;
+            CANCELLED_PAGES++;
+        }
+    }
+    pthread_mutex_unlock(&LOCK);
+}
+
+
+static void print_writeback_stats() {
+    pthread_mutex_lock(&LOCK);
+    printf("Writeback: %ld pages staged, %ld written in %ld pwritev calls (%.1f pages per call, longest run %ld)\n",
+        STAGED_PAGES, WRITTEN_PAGES, WRITE_CALLS, WRITE_CALLS ? (double)WRITTEN_PAGES / WRITE_CALLS : 0.0, LONGEST_RUN);
+    printf("Writeback: %ld swap-ins served from staging, %ld staged pages dropped unwritten, %ld evictions waited for a frame\n",
+        SERVED_FROM_STAGING, CANCELLED_PAGES, STALLS);
+    pthread_mutex_unlock(&LOCK);
+}
+
+
+static void cleanup_writeback() {
+    if (THREAD_RUNNING) {
+        pthread_mutex_lock(&LOCK);
+        SHUTTING_DOWN = 1;
+        pthread_cond_signal(&WORK_AVAILABLE);
+        pthread_mutex_unlock(&LOCK);
+        pthread_join(THREAD, NULL);
+        THREAD_RUNNING = 0;
+    }
+
+    free(STAGING);
+    free(BLOCK_FRAME);
+    STAGING = NULL;
+    BLOCK_FRAME = NULL;
+}
+
+
+const SwapBackend WRITEBACK_SWAP_BACKEND = {
+    "thread", init_writeback, writeback_stage, NULL, writeback_read, writeback_cancel, print_writeback_stats, cleanup_writeback
+};
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "zswap.h"
+
+#define ZSWAP_PAGE_SIZE        4096
+#define ZSWAP_SLAB_SIZE        16384       /* Pool unit handed to a size class when its free list runs out */
+#define LZ_HASH_BITS           12
+#define LZ_MIN_MATCH           4
+
+/* A page is kept compressed only if it fits the largest class, 3/4 of a page */
+static const int SIZE_CLASSES[] = {128, 256, 384, 512, 768, 1024, 1536, 2048, 3072};
+#define NUMBER_OF_SIZE_CLASSES ((int)(sizeof(SIZE_CLASSES) / sizeof(SIZE_CLASSES[0])))
+
+/* Private Global Variables for the Compressed Pool */
+static unsigned char *POOL = NULL;
+static long NUMBER_OF_SLABS = 0;
+static long NEXT_UNUSED_SLAB = 0;
+static int CLASS_FREE_LIST[NUMBER_OF_SIZE_CLASSES];     /* Offset of the first free object, -1 if empty, next offset stored in the object */
+
+static long STORED_PAGES = 0;           /* Pages currently in the pool */
+static long STORED_COMPRESSED_BYTES = 0;
+static long POOL_BYTES_IN_USE = 0;      /* Bytes of the size classes holding them */
+static long REJECTED_INCOMPRESSIBLE = 0;
+static long REJECTED_POOL_FULL = 0;
+static long TOTAL_STORES = 0;
+static long TOTAL_STORED_BYTES = 0;     /* Compressed bytes over all stores, for the compression ratio */
+
+
+
+
+/* ============================================================================================== */
+/*                                          LZ Codec                                              */
+/* ============================================================================================== */
+
+/*
+ * Sequence: token (literal count << 4 | match length - 4, 15 meaning that 255-terminated extension bytes follow),
+ * the literals, then a 2 byte little endian match offset. The last sequence only has literals.
+ */
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static unsigned char *write_length(unsigned char *op, const unsigned char *op_end, int length) {
+    while (length >= 255) {
+        if (op >= op_end) return NULL;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= op_end) return NULL;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+
+/* Writes one sequence, returns NULL if dst is too small */
+static unsigned char *emit_sequence(unsigned char *op, const unsigned char *op_end, const unsigned char *literals,
+                                    int literal_count, int offset, int match_length) {
+    if (op >= op_end) return NULL;
+    unsigned char *token = op++;
+    int match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+    *token = (unsigned char)(((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_count >= 15 && !(op = write_length(op, op_end, literal_count - 15))) return NULL;
+
+    if (op + literal_count > op_end) return NULL;
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+
+    if (match_length) {
+        if (op + 2 > op_end) return NULL;
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+        if (match_code >= 15 && !(op = write_length(op, op_end, match_code - 15))) return NULL;
+    }
+    return op;
+}
+
+
+/* Returns the compressed size, 0 if it does not fit in dst_capacity */
+static int lz_compress(const unsigned char *src, int size, unsigned char *dst, int dst_capacity) {
+    int table[1 << LZ_HASH_BITS];
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+
+    unsigned char *op = dst, *op_end = dst + dst_capacity;
+    int ip = 0, anchor = 0;
+
+    while (ip + LZ_MIN_MATCH <= size) {
+        uint32_t sequence = read32(src + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int candidate = table[hash];
+        table[hash] = ip;
+
+        if (candidate < 0 || read32(src + candidate) != sequence) {
+            ip++;
+            continue;
+        }
+
+        int length = LZ_MIN_MATCH;
+        while (ip + length < size && src[candidate + length] == src[ip + length]) length++;
+
+        op = emit_sequence(op, op_end, src + anchor, ip - anchor, ip - candidate, length);
+        if (!op) return 0;
+        ip += length;
+        anchor = ip;
+    }
+
+    op = emit_sequence(op, op_end, src + anchor, size - anchor, 0, 0);
+    if (!op) return 0;
+    return (int)(op - dst);
+}
+
+
+/* Returns 0 on a malformed input */
+static int lz_decompress(const unsigned char *src, int size, unsigned char *dst, int dst_size) {
+    const unsigned char *ip = src, *ip_end = src + size;
+    unsigned char *op = dst, *op_end = dst + dst_size;
+
+    while (ip < ip_end) {
+        int token = *ip++;
+
+        int literal_count = token >> 4;
+        if (literal_count == 15) {
+            int extension;
+            do {
+                if (ip >= ip_end) return 0;
+                extension = *ip++;
+                literal_count += extension;
+            } while (extension == 255);
+        }
+        if (ip + literal_count > ip_end || op + literal_count > op_end) return 0;
+        memcpy(op, ip, literal_count);
+        ip += literal_count;
+        op += literal_count;
+
+        if (ip == ip_end) break;    /* Last sequence */
+
+        if (ip + 2 > ip_end) return 0;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        int match_length = token & 15;
+        if (match_length == 15) {
+            int extension;
+            do {
+                if (ip >= ip_end) return 0;
+                extension = *ip++;
+                match_length += extension;
+            } while (extension == 255);
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || op - dst < offset || op + match_length > op_end) return 0;
+        const unsigned char *match = op - offset;
+        for (int i = 0; i < match_length; i++) op[i] = match[i];    /* Byte by byte, the match may overlap */
+        op += match_length;
+    }
+
+    return op == op_end;
+}
+
+
+
+
+/* ============================================================================================== */
+/*                                       Slab Managed Pool                                        */
+/* ============================================================================================== */
+
+static int size_class_of(int compressed_size) {
+    for (int c = 0; c < NUMBER_OF_SIZE_CLASSES; c++) {
+        if (compressed_size <= SIZE_CLASSES[c]) return c;
+    }
+    return -1;
+}
+
+
+/* Takes a free object of the class, carving a new slab for it if needed, -1 if the pool is exhausted */
+static int allocate_object(int size_class) {
+    if (CLASS_FREE_LIST[size_class] == -1) {
+        if (NEXT_UNUSED_SLAB == NUMBER_OF_SLABS) return -1;
+
+        int slab = (int)(NEXT_UNUSED_SLAB++ * ZSWAP_SLAB_SIZE);
+        int object_size = SIZE_CLASSES[size_class];
+        for (int offset = slab + (ZSWAP_SLAB_SIZE / object_size - 1) * object_size; offset >= slab; offset -= object_size) {
+            memcpy(POOL + offset, &CLASS_FREE_LIST[size_class], sizeof(int));
+            CLASS_FREE_LIST[size_class] = offset;
+        }
+    }
+
+    int offset = CLASS_FREE_LIST[size_class];
+    memcpy(&CLASS_FREE_LIST[size_class], POOL + offset, sizeof(int));
+    return offset;
+}
+
+
+void init_zswap(long budget_bytes) {
+    NUMBER_OF_SLABS = budget_bytes / ZSWAP_SLAB_SIZE;
+    if (NUMBER_OF_SLABS == 0) {printf("Zswap budget must be at least %d bytes\n", ZSWAP_SLAB_SIZE); exit(2);}
+
+    POOL = (unsigned char *) mmap(NULL, NUMBER_OF_SLABS * ZSWAP_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (POOL == MAP_FAILED) {perror("Failed to allocate zswap pool"); exit(2);}
+
+    for (int c = 0; c < NUMBER_OF_SIZE_CLASSES; c++) CLASS_FREE_LIST[c] = -1;
+}
+
+
+int zswap_enabled() {
+    return POOL != NULL;
+}
+
+
+int zswap_store(const void *page_addr, int *handle, int *compressed_size) {
+    unsigned char buffer[ZSWAP_PAGE_SIZE];
+    int largest_class = SIZE_CLASSES[NUMBER_OF_SIZE_CLASSES - 1];
+
+    int size = lz_compress((const unsigned char *)page_addr, ZSWAP_PAGE_SIZE, buffer, largest_class);
+    if (size == 0) {
+        REJECTED_INCOMPRESSIBLE++;
+        return 0;
+    }
+
+    int size_class = size_class_of(size);
+    int offset = allocate_object(size_class);
+    if (offset == -1) {
+        REJECTED_POOL_FULL++;
+        return 0;
+    }
+
+    memcpy(POOL + offset, buffer, size);
+    *handle = offset;
+    *compressed_size = size;
+
+    STORED_PAGES++;
+    STORED_COMPRESSED_BYTES += size;
+    POOL_BYTES_IN_USE += SIZE_CLASSES[size_class];
+    TOTAL_STORES++;
+    TOTAL_STORED_BYTES += size;
+    return 1;
+}
+
+
+void zswap_load(int handle, int compressed_size, void *page_addr) {
+    if (!lz_decompress(POOL + handle, compressed_size, (unsigned char *)page_addr, ZSWAP_PAGE_SIZE)) {
+        char msg[] = "Zswap: corrupt compressed page\n";
+        write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+        _exit(1);
+    }
+}
+
+
+void zswap_free(int handle, int compressed_size) {
+    int size_class = size_class_of(compressed_size);
+    memcpy(POOL + handle, &CLASS_FREE_LIST[size_class], sizeof(int));
+    CLASS_FREE_LIST[size_class] = handle;
+
+    STORED_PAGES--;
+    STORED_COMPRESSED_BYTES -= compressed_size;
+    POOL_BYTES_IN_USE -= SIZE_CLASSES[size_class];
+}
+
+
+void print_zswap_stats() {
+    if (!POOL) return;
+
+    printf("Zswap: %ld pages compressed (ratio %.2f), %ld left to disk (%ld incompressible, %ld pool full)\n",
+        TOTAL_STORES,
+        TOTAL_STORED_BYTES ? (double)TOTAL_STORES * ZSWAP_PAGE_SIZE / TOTAL_STORED_BYTES : 0.0,
+        REJECTED_INCOMPRESSIBLE + REJECTED_POOL_FULL, REJECTED_INCOMPRESSIBLE, REJECTED_POOL_FULL);
+    printf("Zswap pool: %ld pages held in %ld compressed bytes, %ld of %ld budget bytes in use\n",
+        STORED_PAGES, STORED_COMPRESSED_BYTES, POOL_BYTES_IN_USE, NUMBER_OF_SLABS * ZSWAP_SLAB_SIZE);
+}
+
+
+void cleanup_zswap() {
+    if (POOL) munmap(POOL, NUMBER_OF_SLABS * ZSWAP_SLAB_SIZE);
+    POOL = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef ZSWAP_H
+#define ZSWAP_H
+
+/*
+ * Compressed RAM tier in front of swap.img. Pages are compressed with a small LZ77 codec (LZ4-like sequences of
+ * literals and matches) into a pool of fixed size with its own byte budget, managed as slabs of size classes.
+ * Pages compressing worse than the largest class, or not fitting in the pool, are left to the disk tier.
+ */
+
+void init_zswap(long budget_bytes);
+int zswap_enabled();
+
+/* Compresses and stores a page, returns 1 and its handle and compressed size, 0 if the disk should take it */
+int zswap_store(const void *page_addr, int *handle, int *compressed_size);
+
+void zswap_load(int handle, int compressed_size, void *page_addr);
+void zswap_free(int handle, int compressed_size);
+
+void print_zswap_stats();
+void cleanup_zswap();
+
+#endif
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "replacement_algos.h"
+#include "fault_trace.h"
+
+/*
+ * Replays a fault trace recorded by the loader (--trace) against every policy of replacement_algos.h and Belady's
+ * optimal policy, for a sweep of max_pages values, without running the executable. Every record of the trace is
+ * taken as a reference to its page: page faults and the reference soft faults the loader sampled. References to
+ * resident pages the loader did not sample are not in the trace, so record with a policy that samples references
+ * (LRU, LFU, ARC) to give the policies a richer reference string.
+ */
+
+#define DEFAULT_MAX_SWEEP_PAGES 64
+
+typedef struct Simulation {
+    int policy_idx;             /* Index in REPLACEMENT_POLICIES, NUMBER_OF_REPLACEMENT_POLICIES for OPT */
+    long max_pages;
+    long faults;
+} Simulation;
+
+
+/* Reference string shared by all the simulations */
+unsigned long *REFERENCES = NULL;
+long NUMBER_OF_REFERENCES = 0;
+long NUMBER_OF_DISTINCT_PAGES = 0;
+long *NEXT_USE = NULL;         /* Index of the next reference to the same page, distinct values past the end if none */
+
+Simulation *SIMULATIONS = NULL;
+int NUMBER_OF_SIMULATIONS = 0;
+atomic_int NEXT_SIMULATION = 0;
+
+
+
+
+/* ============================================================================================== */
+/*                                      Trace Loading                                             */
+/* ============================================================================================== */
+
+void load_trace(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {perror("Unable to open trace"); exit(1);}
+
+    FaultTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        printf("Not a fault trace: %s\n", path);
+        exit(1);
+    }
+    if (header.version != TRACE_VERSION) {printf("Unsupported trace version %u\n", header.version); exit(1);}
+
+    unsigned char *data = (unsigned char *) malloc(header.data_size ? header.data_size : 1);
+    if (!data) {printf("Unable to malloc trace data\n"); exit(1);}
+    if (fread(data, 1, header.data_size, file) != header.data_size) {printf("Truncated trace\n"); exit(1);}
+    fclose(file);
+
+    REFERENCES = (unsigned long *) malloc((header.number_of_records + 1) * sizeof(unsigned long));
+    if (!REFERENCES) {printf("Unable to malloc references\n"); exit(1);}
+
+    FaultTraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.time_ns = header.start_time_ns;
+
+    size_t pos = 0;
+    while (NUMBER_OF_REFERENCES < (long)header.number_of_records && decode_fault_record(data, header.data_size, &pos, &record)) {
+        REFERENCES[NUMBER_OF_REFERENCES++] = record.page;
+    }
+    if (NUMBER_OF_REFERENCES != (long)header.number_of_records) {printf("Trace has fewer records than its header says\n"); exit(1);}
+    free(data);
+
+    printf("Trace: %ld references recorded with %s and %u max pages", NUMBER_OF_REFERENCES, header.policy, header.max_pages);
+    if (header.dropped_records) printf(" (%u faults dropped, trace was full)", header.dropped_records);
+    printf("\n");
+}
+
+
+/* Fills NEXT_USE walking the references backwards, also counting the distinct pages */
+void compute_next_uses() {
+    NEXT_USE = (long *) malloc((NUMBER_OF_REFERENCES + 1) * sizeof(long));
+    if (!NEXT_USE) {printf("Unable to malloc next uses\n"); exit(1);}
+
+    PageMap last_use;
+    page_map_init(&last_use, NUMBER_OF_REFERENCES + 1);
+
+    for (long i = NUMBER_OF_REFERENCES - 1; i >= 0; i--) {
+        int next = page_map_get(&last_use, REFERENCES[i]);
+        if (next == -1) {
+            NEXT_USE[i] = NUMBER_OF_REFERENCES + i;     /* Never used again, kept distinct so heap entries identify one reference */
+            NUMBER_OF_DISTINCT_PAGES++;
+        }
+        else NEXT_USE[i] = next;
+        page_map_put(&last_use, REFERENCES[i], (int)i);
+    }
+
+    page_map_free(&last_use);
+}
+
+
+
+
+/* ============================================================================================== */
+/*                                        Simulations                                             */
+/* ============================================================================================== */
+
+/* Runs a policy of replacement_algos.h over the references, returns the number of faults */
+long simulate_policy(const ReplacementPolicy *policy, long max_pages) {
+    void *state = policy->create(max_pages, NULL);
+
+    PageMap resident;
+    page_map_init(&resident, max_pages);
+    long resident_pages = 0, faults = 0;
+
+    for (long i = 0; i < NUMBER_OF_REFERENCES; i++) {
+        unsigned long page = REFERENCES[i];
+
+        if (page_map_get(&resident, page) != -1) {
+            if (policy->on_access) policy->on_access(state, page);
+            continue;
+        }
+
+        faults++;
+        if (resident_pages == max_pages) {
+            page_map_remove(&resident, policy->choose_victim(state, page));
+            resident_pages--;
+        }
+        policy->on_fault(state, page);
+        page_map_put(&resident, page, 1);
+        resident_pages++;
+    }
+
+    page_map_free(&resident);
+    policy->destroy(state);
+    return faults;
+}
+
+
+
+/* Belady's OPT: evicts the resident page used furthest in the future, using a max-heap on next use where entries
+ * whose next use is no longer current for their page are skipped lazily */
+typedef struct HeapEntry {
+    long next_use;
+    unsigned long page;
+} HeapEntry;
+
+
+void heap_push(HeapEntry *heap, long *size, HeapEntry entry) {
+    long i = (*size)++;
+    while (i > 0 && heap[(i - 1) / 2].next_use < entry.next_use) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = entry;
+}
+
+
+HeapEntry heap_pop(HeapEntry *heap, long *size) {
+    HeapEntry top = heap[0];
+    HeapEntry last = heap[--(*size)];
+
+    long i = 0;
+    while (1) {
+        long child = 2 * i + 1;
+        if (child >= *size) break;
+        if (child + 1 < *size && heap[child + 1].next_use > heap[child].next_use) child++;
+        if (heap[child].next_use <= last.next_use) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*size > 0) heap[i] = last;
+    return top;
+}
+
+
+long simulate_opt(long max_pages) {
+    /* Resident page to the index of its latest reference, whose NEXT_USE is the page's current next use */
+    PageMap resident;
+    page_map_init(&resident, max_pages);
+
+    HeapEntry *heap = (HeapEntry *) malloc((NUMBER_OF_REFERENCES + 1) * sizeof(HeapEntry));
+    if (!heap) {printf("Unable to malloc OPT heap\n"); exit(1);}
+    long heap_size = 0, resident_pages = 0, faults = 0;
+
+    for (long i = 0; i < NUMBER_OF_REFERENCES; i++) {
+        unsigned long page = REFERENCES[i];
+
+        if (page_map_get(&resident, page) == -1) {
+            faults++;
+            if (resident_pages == max_pages) {
+                while (1) {
+                    HeapEntry top = heap_pop(heap, &heap_size);
+                    int latest = page_map_get(&resident, top.page);
+                    if (latest != -1 && NEXT_USE[latest] == top.next_use) {
+                        page_map_remove(&resident, top.page);
+                        break;
+                    }
+                }
+                resident_pages--;
+            }
+            resident_pages++;
+        }
+
+        page_map_put(&resident, page, (int)i);
+        heap_push(heap, &heap_size, (HeapEntry){NEXT_USE[i], page});
+    }
+
+    free(heap);
+    page_map_free(&resident);
+    return faults;
+}
+
+
+
+/* Worker taking simulations off the shared list until none is left */
+void *simulation_worker(void *args) {
+    while (1) {
+        int idx = atomic_fetch_add(&NEXT_SIMULATION, 1);
+        if (idx >= NUMBER_OF_SIMULATIONS) return NULL;
+
+        Simulation *simulation = &SIMULATIONS[idx];
+        if (simulation->policy_idx == NUMBER_OF_REPLACEMENT_POLICIES) simulation->faults = simulate_opt(simulation->max_pages);
+        else simulation->faults = simulate_policy(&REPLACEMENT_POLICIES[simulation->policy_idx], simulation->max_pages);
+    }
+}
+
+
+
+
+/* ============================================================================================== */
+/*                                           Report                                               */
+/* ============================================================================================== */
+
+void print_results(long min_pages, long max_pages, long step) {
+    int columns = NUMBER_OF_REPLACEMENT_POLICIES + 1;
+
+    printf("\nFaults per policy, gap to OPT in parentheses\n");
+    printf("%9s", "max_pages");
+    for (int p = 0; p < NUMBER_OF_REPLACEMENT_POLICIES; p++) printf(" %18s", REPLACEMENT_POLICIES[p].name);
+    printf(" %10s\n", "OPT");
+
+    int row = 0;
+    for (long pages = min_pages; pages <= max_pages; pages += step, row++) {
+        Simulation *results = &SIMULATIONS[row * columns];
+        long opt = results[NUMBER_OF_REPLACEMENT_POLICIES].faults;
+
+        printf("%9ld", pages);
+        for (int p = 0; p < NUMBER_OF_REPLACEMENT_POLICIES; p++) {
+            char cell[32];
+            double gap = opt ? 100.0 * (double)(results[p].faults - opt) / (double)opt : 0.0;
+            snprintf(cell, sizeof(cell), "%ld (+%.1f%%)", results[p].faults, gap);
+            printf(" %18s", cell);
+        }
+        printf(" %10ld\n", opt);
+    }
+}
+
+
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s <Trace File> [Options]\n", argv[0]);
+        printf("Options:\n");
+        printf("  --min <Pages>      Smallest max_pages simulated (default 1)\n");
+        printf("  --max <Pages>      Largest max_pages simulated (default: distinct pages of the trace, at most %d)\n", DEFAULT_MAX_SWEEP_PAGES);
+        printf("  --step <Pages>     Increment of max_pages (default 1)\n");
+        printf("  --threads <N>      Simulation threads (default 4)\n");
+        exit(1);
+    }
+
+    long min_pages = 1, max_pages = 0, step = 1;
+    int number_of_threads = 4;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) {printf("Missing value for %s\n", argv[i]); exit(1);}
+        if (strcmp(argv[i], "--min") == 0) min_pages = atol(argv[++i]);
+        else if (strcmp(argv[i], "--max") == 0) max_pages = atol(argv[++i]);
+        else if (strcmp(argv[i], "--step") == 0) step = atol(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) number_of_threads = atoi(argv[++i]);
+        else {printf("Unknown option: %s\n", argv[i]); exit(1);}
+    }
+
+    load_trace(argv[1]);
+    if (NUMBER_OF_REFERENCES == 0) {printf("Empty trace\n"); return 0;}
+    compute_next_uses();
+    printf("Distinct pages: %ld\n", NUMBER_OF_DISTINCT_PAGES);
+
+    if (max_pages == 0) max_pages = NUMBER_OF_DISTINCT_PAGES < DEFAULT_MAX_SWEEP_PAGES ? NUMBER_OF_DISTINCT_PAGES : DEFAULT_MAX_SWEEP_PAGES;
+    if (min_pages <= 0 || step <= 0 || max_pages < min_pages || number_of_threads <= 0) {printf("Invalid sweep\n"); exit(1);}
+
+    /* One simulation per (max_pages, policy) pair, OPT being the last column */
+    int columns = NUMBER_OF_REPLACEMENT_POLICIES + 1;
+    int rows = (int)((max_pages - min_pages) / step + 1);
+    NUMBER_OF_SIMULATIONS = rows * columns;
+    SIMULATIONS = (Simulation *) malloc(NUMBER_OF_SIMULATIONS * sizeof(Simulation));
+    if (!SIMULATIONS) {printf("Unable to malloc simulations\n"); exit(1);}
+
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < columns; c++) {
+            SIMULATIONS[r * columns + c].policy_idx = c;
+            SIMULATIONS[r * columns + c].max_pages = min_pages + r * step;
+            SIMULATIONS[r * columns + c].faults = 0;
+        }
+    }
+
+    pthread_t *threads = (pthread_t *) malloc(number_of_threads * sizeof(pthread_t));
+    if (!threads) {printf("Unable to malloc threads\n"); exit(1);}
+    for (int t = 0; t < number_of_threads; t++) {
+        if (pthread_create(&threads[t], NULL, simulation_worker, NULL) != 0) {printf("Unable to create thread\n"); exit(1);}
+    }
+    for (int t = 0; t < number_of_threads; t++) pthread_join(threads[t], NULL);
+
+    print_results(min_pages, max_pages, step);
+
+    free(threads);
+    free(SIMULATIONS);
+    free(NEXT_USE);
+    free(REFERENCES);
+    return 0;
+}
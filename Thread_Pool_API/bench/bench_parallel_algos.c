@@ -0,0 +1,133 @@
+/* 
+ * Benchmark of parallel_sort against qsort and of parallel_inclusive_scan and parallel_exclusive_scan against serial scans,
+ * over several array sizes and thread counts.
+ * 
+ * gcc -O2 -Iinclude bench/bench_parallel_algos.c src/parallel_algos.c src/thread_pool.c -o bench_parallel_algos -lpthread
+*/
+#include "thread_pool.h"
+#include "parallel_algos.h"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+
+
+
+static const size_t ARRAY_SIZES[] = {1 << 16, 1 << 20, 1 << 23};
+static const int THREAD_COUNTS[] = {1, 2, 4, 8};
+
+#define NUMBER_OF_SIZES (sizeof(ARRAY_SIZES) / sizeof(ARRAY_SIZES[0]))
+#define NUMBER_OF_THREAD_COUNTS (sizeof(THREAD_COUNTS) / sizeof(THREAD_COUNTS[0]))
+
+
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*) a;
+    int y = *(const int*) b;
+    return (x > y) - (x < y);
+}
+
+
+static void serial_inclusive_scan(const long* in, long* out, size_t count) {
+    long running = 0;
+    for (size_t i = 0; i < count; i++) {
+        running += in[i];
+        out[i] = running;
+    }
+}
+
+
+static void serial_exclusive_scan(const long* in, long* out, size_t count) {
+    long running = 0;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = running;
+        running += in[i];
+    }
+}
+
+
+
+int main() {
+    size_t max_size = ARRAY_SIZES[NUMBER_OF_SIZES - 1];
+
+    int* input = (int*) malloc(max_size * sizeof(int));
+    int* sorted = (int*) malloc(max_size * sizeof(int));
+    int* work = (int*) malloc(max_size * sizeof(int));
+    long* values = (long*) malloc(max_size * sizeof(long));
+    long* expected = (long*) malloc(max_size * sizeof(long));
+    long* scanned = (long*) malloc(max_size * sizeof(long));
+    long* expected_exclusive = (long*) malloc(max_size * sizeof(long));
+    long* scanned_exclusive = (long*) malloc(max_size * sizeof(long));
+    if (!input || !sorted || !work || !values || !expected || !scanned || !expected_exclusive || !scanned_exclusive) {printf("Malloc for benchmark arrays failed\n"); return 1;}
+
+    srand(42);
+    for (size_t i = 0; i < max_size; i++) {
+        input[i] = rand();
+        values[i] = rand() % 1000;
+    }
+
+    printf("%-10s %-8s %12s %12s %8s %12s %12s %8s %12s %12s %8s\n", "elements", "threads", "qsort ms", "psort ms", "speedup", 
+        "scan ms", "pscan ms", "speedup", "escan ms", "pescan ms", "speedup");
+
+    for (size_t s = 0; s < NUMBER_OF_SIZES; s++) {
+        size_t count = ARRAY_SIZES[s];
+
+        /* Serial baselines, also used to check the parallel results */
+        memcpy(sorted, input, count * sizeof(int));
+        double start = now_ms();
+        qsort(sorted, count, sizeof(int), compare_ints);
+        double qsort_ms = now_ms() - start;
+
+        start = now_ms();
+        serial_inclusive_scan(values, expected, count);
+        double scan_ms = now_ms() - start;
+
+        start = now_ms();
+        serial_exclusive_scan(values, expected_exclusive, count);
+        double escan_ms = now_ms() - start;
+
+        for (size_t t = 0; t < NUMBER_OF_THREAD_COUNTS; t++) {
+            if (thread_pool_init(THREAD_COUNTS[t]) == 0) {printf("thread_pool_init failed\n"); return 1;}
+
+            memcpy(work, input, count * sizeof(int));
+            start = now_ms();
+            parallel_sort(work, count, sizeof(int), compare_ints);
+            double psort_ms = now_ms() - start;
+
+            start = now_ms();
+            parallel_inclusive_scan(values, scanned, count);
+            double pscan_ms = now_ms() - start;
+
+            start = now_ms();
+            parallel_exclusive_scan(values, scanned_exclusive, count);
+            double pescan_ms = now_ms() - start;
+
+            thread_pool_cleanup();
+
+            if (memcmp(work, sorted, count * sizeof(int)) != 0) printf("parallel_sort result mismatch\n");
+            if (memcmp(scanned, expected, count * sizeof(long)) != 0) printf("parallel_inclusive_scan result mismatch\n");
+            if (memcmp(scanned_exclusive, expected_exclusive, count * sizeof(long)) != 0) printf("parallel_exclusive_scan result mismatch\n");
+
+            printf("%-10zu %-8d %12.2f %12.2f %7.2fx %12.2f %12.2f %7.2fx %12.2f %12.2f %7.2fx\n", count, THREAD_COUNTS[t], 
+                qsort_ms, psort_ms, qsort_ms / psort_ms, scan_ms, pscan_ms, scan_ms / pscan_ms, escan_ms, pescan_ms, escan_ms / pescan_ms);
+        }
+    }
+
+    free(input);
+    free(sorted);
+    free(work);
+    free(values);
+    free(expected);
+    free(scanned);
+    free(expected_exclusive);
+    free(scanned_exclusive);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef PARALLEL_ALGOS_API
+#define PARALLEL_ALGOS_API
+
+#include<stddef.h>
+
+
+
+/**
+ * Sorts the array using the workers of the thread pool (thread_pool_init must have been called).
+ * Cache-sized leaf chunks are sorted with qsort in parallel, then merged pairwise, each merge being split
+ * into leaf-sized pieces so every pass keeps all the workers busy. The sort is stable across chunks.
+ * Must not be called from inside a job of the pool.
+ * Returns 0 on error.
+ * 
+ * @param base The array to sort, same convention as qsort.
+ * @param count The number of elements.
+ * @param size The size of one element in bytes.
+ * @param compare The comparison function, same convention as qsort.
+*/
+int parallel_sort(void* base, size_t count, size_t size, int (*compare)(const void*, const void*));
+
+
+
+/**
+ * Computes out[i] = in[0] + ... + in[i] using the workers of the thread pool (thread_pool_init must have been called).
+ * in and out may be the same array.
+ * Must not be called from inside a job of the pool.
+ * Returns 0 on error.
+ * 
+ * @param in The input array.
+ * @param out The output array, at least count elements long.
+ * @param count The number of elements.
+*/
+int parallel_inclusive_scan(const long* in, long* out, size_t count);
+
+
+
+/**
+ * Computes out[i] = in[0] + ... + in[i - 1] (out[0] = 0) using the workers of the thread pool (thread_pool_init must have been called).
+ * in and out may be the same array.
+ * Must not be called from inside a job of the pool.
+ * Returns 0 on error.
+ * 
+ * @param in The input array.
+ * @param out The output array, at least count elements long.
+ * @param count The number of elements.
+*/
+int parallel_exclusive_scan(const long* in, long* out, size_t count);
+
+
+
+#endif
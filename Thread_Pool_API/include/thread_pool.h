@@ -1,11 +1,13 @@
 #ifndef THREAD_POOL_API
 #define THREAD_POOL_API
 
+#define THREAD_POOL_FD_ONESHOT 0        /* fd job runs once, on the first readiness */
+#define THREAD_POOL_FD_PERSISTENT 1     /* fd job runs on every readiness until removed */
 
 
 /**
  * Initialises the thread pool.
- * Returns 0 if error.
+ * Returns 0 if error, including a num_threads which is not positive.
  * 
  * @param num_threads The number of threads (excluding the main thread calling this) to have on standby (and later working).
 */
@@ -25,6 +27,33 @@ int thread_pool_add_job(void (*func_ptr_to_task)(void*), void* args);
 
 
 
+/**
+ * Adds a task which runs as a coroutine on its own stack.
+ * Inside it thread_pool_yield and thread_pool_wait_fd give the worker back to the pool, which runs other jobs until the coroutine is resumed.
+ * The coroutine may be resumed by a different worker than the one it yielded on.
+ * Returns 0 on error.
+ * 
+ * @param func_ptr_to_task The function pointer to the task to be done. Argument to the function must be a void* pointer and return type void.
+ * @param args The arguments to the function pointer, must be a void* pointer.
+*/
+int thread_pool_add_coroutine_job(void (*func_ptr_to_task)(void*), void* args);
+
+
+
+/**
+ * Adds task to be completed preferably by the worker selected by the key (key % number of workers).
+ * Jobs sharing a key run on the same worker, in FIFO order, so state it touched stays warm in that worker's cache.
+ * If that worker falls far behind, idle workers may take its oldest jobs.
+ * Returns 0 on error.
+ * 
+ * @param func_ptr_to_task The function pointer to the task to be done. Argument to the function must be a void* pointer and return type void.
+ * @param args The arguments to the function pointer, must be a void* pointer.
+ * @param key The affinity key (a worker index or any value identifying the state the job works on, e.g. a connection id).
+*/
+int thread_pool_add_job_affinity(void (*func_ptr_to_task)(void*), void* args, unsigned long key);
+
+
+
 /**
  * Wait untill all the jobs given to the thread pool are completed (all the workers will be free after the completion of this call).
 */
@@ -32,6 +61,54 @@ void thread_pool_wait();
 
 
 
+/**
+ * Gives the worker back to the pool from inside a coroutine job, the coroutine is resumed after the jobs queued before it.
+ * Does nothing when called from a plain job.
+*/
+void thread_pool_yield();
+
+
+
+/**
+ * Waits until the fd is ready for the given epoll events (e.g. EPOLLIN).
+ * Inside a coroutine job the worker runs other jobs meanwhile, in a plain job the worker blocks in poll.
+ * Only one coroutine may wait on a given fd at a time.
+ * Returns the ready events, or -1 on error.
+ * 
+ * @param fd The file descriptor to wait on.
+ * @param events The epoll events to wait for.
+*/
+int thread_pool_wait_fd(int fd, unsigned int events);
+
+
+
+/**
+ * Registers a job to be queued whenever the fd becomes ready for the given epoll events (e.g. EPOLLIN).
+ * A one-shot registration is dropped after its first job, a persistent one is re-armed each time its job returns,
+ * so at most one job per fd is queued or running at a time.
+ * Only one registration per fd is allowed.
+ * Returns 0 on error.
+ * 
+ * @param fd The file descriptor to watch.
+ * @param events The epoll events to wait for.
+ * @param func_ptr_to_task The function pointer to the task to be done. Argument to the function must be a void* pointer and return type void.
+ * @param args The arguments to the function pointer, must be a void* pointer.
+ * @param mode THREAD_POOL_FD_ONESHOT or THREAD_POOL_FD_PERSISTENT.
+*/
+int thread_pool_add_fd_job(int fd, unsigned int events, void (*func_ptr_to_task)(void*), void* args, int mode);
+
+
+
+/**
+ * Unregisters the fd job of the fd, a job already queued for it still runs.
+ * Returns 0 if the fd has no registration.
+ * 
+ * @param fd The file descriptor passed to thread_pool_add_fd_job.
+*/
+int thread_pool_remove_fd_job(int fd);
+
+
+
 /**
  * Completely cleans up the thread pool.
 */
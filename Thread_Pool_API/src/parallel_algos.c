@@ -0,0 +1,445 @@
+#include "parallel_algos.h"
+#include "thread_pool.h"
+
+#include<pthread.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+
+
+// =================================================
+//                    Structs
+// =================================================
+
+typedef struct Task_group {
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int remaining;                      /* Tasks submitted and not yet finished */
+
+} Task_group;
+
+
+
+typedef struct Group_job {
+
+    Task_group* group;
+    void (*func)(void*);
+    void* args;
+
+} Group_job;
+
+
+
+typedef struct Sort_task {
+
+    Task_group* group;
+    char* base;                         /* qsort of a leaf chunk: the chunk */
+    size_t count;
+    const char* left;                   /* Merge piece: the two sorted runs being merged */
+    size_t left_count;
+    const char* right;
+    size_t right_count;
+    char* out;                          /* Merge piece: destination of the whole merged run */
+    size_t out_start;                   /* Merge piece: range of the merged run produced by this task */
+    size_t out_end;
+    size_t size;
+    int (*compare)(const void*, const void*);
+
+} Sort_task;
+
+
+
+typedef struct Scan_task {
+
+    Task_group* group;
+    const long* in;
+    long* out;
+    size_t count;
+    long offset;                        /* Sum of all the elements before this block */
+    long sum;                           /* Sum of this block, output of the first pass */
+    int inclusive;
+
+} Scan_task;
+
+
+
+// =================================================
+//                 GLOBAL VARIABLES
+// =================================================
+
+#define LEAF_CHUNK_BYTES (256 * 1024)               /* Leaf chunks are sized to stay in a core's L2 cache */
+
+
+
+// =================================================
+//                Internal Functions
+// =================================================
+
+static void _task_group_init(Task_group* group);
+static void _task_group_run(void* args);
+static void _task_group_submit(Task_group* group, void (*func)(void*), void* args);
+static void _task_group_wait(Task_group* group);
+static void _task_group_destroy(Task_group* group);
+
+static size_t _leaf_elements(size_t size);
+static size_t _co_rank(size_t k, const char* left, size_t left_count, const char* right, size_t right_count, size_t size, int (*compare)(const void*, const void*));
+static void _sort_leaf(void* args);
+static void _merge_piece(void* args);
+
+static void _scan_block_sum(void* args);
+static void _scan_block_write(void* args);
+static int _parallel_scan(const long* in, long* out, size_t count, int inclusive);
+
+
+
+/**
+ * Sorts the array using the workers of the thread pool (thread_pool_init must have been called).
+ * Cache-sized leaf chunks are sorted with qsort in parallel, then merged pairwise, each merge being split
+ * into leaf-sized pieces so every pass keeps all the workers busy. The sort is stable across chunks.
+ * Must not be called from inside a job of the pool.
+ * Returns 0 on error.
+ * 
+ * @param base The array to sort, same convention as qsort.
+ * @param count The number of elements.
+ * @param size The size of one element in bytes.
+ * @param compare The comparison function, same convention as qsort.
+*/
+int parallel_sort(void* base, size_t count, size_t size, int (*compare)(const void*, const void*)) {
+    if (!base || !compare || size == 0) {printf("Invalid arguments to parallel_sort\n"); return 0;}
+
+    size_t leaf = _leaf_elements(size);
+    if (count <= leaf) {qsort(base, count, size, compare); return 1;}
+
+    size_t number_of_leaves = (count + leaf - 1) / leaf;
+
+    char* buffer = (char*) malloc(count * size);
+    Sort_task* tasks = (Sort_task*) calloc(number_of_leaves, sizeof(Sort_task));
+    if (!buffer || !tasks) {
+        printf("Malloc for parallel_sort failed\n");
+        free(buffer);
+        free(tasks);
+        return 0;
+    }
+
+    Task_group group;
+    _task_group_init(&group);
+
+    /* Sort every leaf chunk */
+    for (size_t i = 0; i < number_of_leaves; i++) {
+        size_t start = i * leaf;
+        tasks[i].group = &group;
+        tasks[i].base = (char*) base + start * size;
+        tasks[i].count = (start + leaf <= count) ? leaf : count - start;
+        tasks[i].size = size;
+        tasks[i].compare = compare;
+        _task_group_submit(&group, _sort_leaf, &tasks[i]);
+    }
+    _task_group_wait(&group);
+
+    /* Merge runs of doubling width, ping-ponging between the array and the buffer */
+    char* src = (char*) base;
+    char* dst = buffer;
+
+    for (size_t width = leaf; width < count; width *= 2) {
+        size_t number_of_tasks = 0;
+
+        for (size_t run_start = 0; run_start < count; run_start += 2 * width) {
+            size_t left_count = (run_start + width <= count) ? width : count - run_start;
+            size_t right_count = (run_start + left_count + width <= count) ? width : count - run_start - left_count;
+            size_t merged = left_count + right_count;
+
+            for (size_t piece = 0; piece < merged; piece += leaf) {
+                Sort_task* task = &tasks[number_of_tasks++];
+                task->group = &group;
+                task->left = src + run_start * size;
+                task->left_count = left_count;
+                task->right = task->left + left_count * size;
+                task->right_count = right_count;
+                task->out = dst + run_start * size;
+                task->out_start = piece;
+                task->out_end = (piece + leaf <= merged) ? piece + leaf : merged;
+                task->size = size;
+                task->compare = compare;
+                _task_group_submit(&group, _merge_piece, task);
+            }
+        }
+        _task_group_wait(&group);
+
+        char* temp = src;
+        src = dst;
+        dst = temp;
+    }
+
+    if (src != (char*) base) memcpy(base, src, count * size);
+
+    _task_group_destroy(&group);
+    free(tasks);
+    free(buffer);
+    return 1;
+}
+
+
+
+/**
+ * Computes out[i] = in[0] + ... + in[i] using the workers of the thread pool (thread_pool_init must have been called).
+ * in and out may be the same array.
+ * Must not be called from inside a job of the pool.
+ * Returns 0 on error.
+ * 
+ * @param in The input array.
+ * @param out The output array, at least count elements long.
+ * @param count The number of elements.
+*/
+int parallel_inclusive_scan(const long* in, long* out, size_t count) {
+    return _parallel_scan(in, out, count, 1);
+}
+
+
+
+/**
+ * Computes out[i] = in[0] + ... + in[i - 1] (out[0] = 0) using the workers of the thread pool (thread_pool_init must have been called).
+ * in and out may be the same array.
+ * Must not be called from inside a job of the pool.
+ * Returns 0 on error.
+ * 
+ * @param in The input array.
+ * @param out The output array, at least count elements long.
+ * @param count The number of elements.
+*/
+int parallel_exclusive_scan(const long* in, long* out, size_t count) {
+    return _parallel_scan(in, out, count, 0);
+}
+
+
+
+// =================================================
+//                 Sort Functions
+// =================================================
+
+/**
+ * Number of elements of the given size fitting in a leaf chunk (at least 1).
+*/
+static size_t _leaf_elements(size_t size) {
+    size_t leaf = LEAF_CHUNK_BYTES / size;
+    return leaf ? leaf : 1;
+}
+
+
+
+/**
+ * Returns how many elements of left come before output index k when merging left and right stably
+ * (left wins ties), found by binary search on the merge path.
+*/
+static size_t _co_rank(size_t k, const char* left, size_t left_count, const char* right, size_t right_count, size_t size, int (*compare)(const void*, const void*)) {
+    size_t low = (k > right_count) ? k - right_count : 0;
+    size_t high = (k < left_count) ? k : left_count;
+
+    while (low < high) {
+        size_t i = low + (high - low) / 2;
+        size_t j = k - i;
+
+        /* Too few elements taken from left while right[j - 1] is not smaller than left[i] */
+        if (j > 0 && i < left_count && compare(right + (j - 1) * size, left + i * size) >= 0) low = i + 1;
+        else high = i;
+    }
+    return low;
+}
+
+
+
+/**
+ * Task sorting one leaf chunk with qsort.
+*/
+static void _sort_leaf(void* args) {
+    Sort_task* task = (Sort_task*) args;
+    qsort(task->base, task->count, task->size, task->compare);
+}
+
+
+
+/**
+ * Task producing the range [out_start, out_end) of the merge of two sorted runs.
+*/
+static void _merge_piece(void* args) {
+    Sort_task* task = (Sort_task*) args;
+    size_t size = task->size;
+
+    size_t i = _co_rank(task->out_start, task->left, task->left_count, task->right, task->right_count, size, task->compare);
+    size_t i_end = _co_rank(task->out_end, task->left, task->left_count, task->right, task->right_count, size, task->compare);
+    size_t j = task->out_start - i;
+    size_t j_end = task->out_end - i_end;
+
+    char* out = task->out + task->out_start * size;
+
+    while (i < i_end && j < j_end) {
+        const char* left = task->left + i * size;
+        const char* right = task->right + j * size;
+
+        if (task->compare(left, right) <= 0) {memcpy(out, left, size); i++;}
+        else {memcpy(out, right, size); j++;}
+        out += size;
+    }
+
+    if (i < i_end) memcpy(out, task->left + i * size, (i_end - i) * size);
+    else if (j < j_end) memcpy(out, task->right + j * size, (j_end - j) * size);
+}
+
+
+
+// =================================================
+//                 Scan Functions
+// =================================================
+
+/**
+ * Two pass blocked scan: each block's sum is computed in parallel, the block offsets are scanned serially
+ * (one value per block), then each block writes its prefix sums in parallel starting from its offset.
+ * Returns 0 on error.
+*/
+static int _parallel_scan(const long* in, long* out, size_t count, int inclusive) {
+    if (!in || !out) {printf("Invalid arguments to parallel scan\n"); return 0;}
+    if (count == 0) return 1;
+
+    size_t block = _leaf_elements(sizeof(long));
+    size_t number_of_blocks = (count + block - 1) / block;
+
+    Scan_task* tasks = (Scan_task*) calloc(number_of_blocks, sizeof(Scan_task));
+    if (!tasks) {printf("Malloc for parallel scan failed\n"); return 0;}
+
+    Task_group group;
+    _task_group_init(&group);
+
+    for (size_t i = 0; i < number_of_blocks; i++) {
+        size_t start = i * block;
+        tasks[i].group = &group;
+        tasks[i].in = in + start;
+        tasks[i].out = out + start;
+        tasks[i].count = (start + block <= count) ? block : count - start;
+        tasks[i].inclusive = inclusive;
+        _task_group_submit(&group, _scan_block_sum, &tasks[i]);
+    }
+    _task_group_wait(&group);
+
+    long offset = 0;
+    for (size_t i = 0; i < number_of_blocks; i++) {
+        tasks[i].offset = offset;
+        offset += tasks[i].sum;
+    }
+
+    for (size_t i = 0; i < number_of_blocks; i++) _task_group_submit(&group, _scan_block_write, &tasks[i]);
+    _task_group_wait(&group);
+
+    _task_group_destroy(&group);
+    free(tasks);
+    return 1;
+}
+
+
+
+/**
+ * Task summing one block.
+*/
+static void _scan_block_sum(void* args) {
+    Scan_task* task = (Scan_task*) args;
+    long sum = 0;
+    for (size_t i = 0; i < task->count; i++) sum += task->in[i];
+    task->sum = sum;
+}
+
+
+
+/**
+ * Task writing the prefix sums of one block, reads each element before overwriting it so in may equal out.
+*/
+static void _scan_block_write(void* args) {
+    Scan_task* task = (Scan_task*) args;
+    long running = task->offset;
+
+    if (task->inclusive) {
+        for (size_t i = 0; i < task->count; i++) {
+            running += task->in[i];
+            task->out[i] = running;
+        }
+    } else {
+        for (size_t i = 0; i < task->count; i++) {
+            long value = task->in[i];
+            task->out[i] = running;
+            running += value;
+        }
+    }
+}
+
+
+
+// =================================================
+//               Task Group Functions
+// =================================================
+
+/**
+ * Initialises a group of tasks which can be waited on independently of the other jobs of the pool.
+*/
+static void _task_group_init(Task_group* group) {
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+    group->remaining = 0;
+}
+
+
+
+/**
+ * Runs a task of the group and signals the waiter once the last one finishes.
+*/
+static void _task_group_run(void* args) {
+    Group_job* job = (Group_job*) args;
+    Task_group* group = job->group;
+
+    job->func(job->args);
+    free(job);
+
+    pthread_mutex_lock(&group->lock);
+    group->remaining--;
+    if (group->remaining == 0) pthread_cond_signal(&group->done);
+    pthread_mutex_unlock(&group->lock);
+}
+
+
+
+/**
+ * Submits a task of the group to the pool, runs it on the calling thread if it cannot be submitted.
+*/
+static void _task_group_submit(Task_group* group, void (*func)(void*), void* args) {
+    Group_job* job = (Group_job*) malloc(sizeof(Group_job));
+    if (!job) {func(args); return;}
+
+    job->group = group;
+    job->func = func;
+    job->args = args;
+
+    pthread_mutex_lock(&group->lock);
+    group->remaining++;
+    pthread_mutex_unlock(&group->lock);
+
+    if (thread_pool_add_job(_task_group_run, job) == 0) _task_group_run(job);
+}
+
+
+
+/**
+ * Blocks until every task submitted to the group has finished.
+*/
+static void _task_group_wait(Task_group* group) {
+    pthread_mutex_lock(&group->lock);
+    while (group->remaining > 0) pthread_cond_wait(&group->done, &group->lock);
+    pthread_mutex_unlock(&group->lock);
+}
+
+
+
+/**
+ * Destroys the synchronisation primitives of the group.
+*/
+static void _task_group_destroy(Task_group* group) {
+    pthread_cond_destroy(&group->done);
+    pthread_mutex_destroy(&group->lock);
+}
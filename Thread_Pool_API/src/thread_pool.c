@@ -3,6 +3,14 @@
 #include<pthread.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<stdatomic.h>
+#include<unistd.h>
+#include<poll.h>
+#include<ucontext.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
 
 
 
@@ -10,10 +18,41 @@
 //                    Structs
 // =================================================
 
+typedef struct FdWatch {
+
+    int fd;
+    uint32_t events;
+    int persistent;                     /* Re-armed after each job instead of being dropped after the first one */
+    struct Job* coroutine_job;          /* Parked coroutine to resume, NULL for fd jobs */
+    void (*func_to_the_job)(void*);     /* Job queued on readiness when coroutine_job is NULL */
+    void* args;
+    int removed;                        /* Set once unregistered, guarded by LOCK_POOL */
+    int in_flight;                      /* Set while a job created from this watch is queued or running, guarded by LOCK_POOL */
+    struct FdWatch* next;
+
+} FdWatch;
+
+
+
+typedef struct Coroutine {
+
+    ucontext_t context;                 /* Saved state of the coroutine while it is not running */
+    ucontext_t* worker_context;         /* Context of the worker currently running it, switched back to on yield */
+    void* stack;
+    int state;                          /* One of the COROUTINE_* states */
+    FdWatch watch;                      /* Fd and events waited on while state is COROUTINE_WAITING_FD */
+    uint32_t ready_events;              /* Events reported by the reactor when the coroutine is resumed */
+
+} Coroutine;
+
+
+
 typedef struct Job {
 
     void (*func_to_the_job)(void*);
     void* args;
+    Coroutine* coroutine;               /* NULL for plain jobs */
+    FdWatch* watch;                     /* Persistent watch to re-arm once the job is done, NULL otherwise */
     struct Job* next;
 
 } Job;
@@ -30,22 +69,52 @@ typedef struct Queue_job {
 
 
 
+typedef struct Worker_slot {
+
+    pthread_cond_t cond;                /* Signaled to wake this worker only */
+    int idle;                           /* Set while the worker sleeps on cond and nobody woke it yet, guarded by LOCK_POOL */
+
+} Worker_slot;
+
+
+
 // =================================================
 //                 GLOBAL VARIABLES
 // =================================================
 
+#define AFFINITY_STEAL_THRESHOLD 4              /* Local queue length above which idle workers may steal from it */
+#define COROUTINE_STACK_SIZE (64 * 1024)        /* Stack of each coroutine job */
+#define REACTOR_MAX_EVENTS 64                   /* Events fetched and queued as one batch */
+
+#define COROUTINE_RUNNING 0
+#define COROUTINE_YIELDED 1
+#define COROUTINE_WAITING_FD 2
+#define COROUTINE_FINISHED 3
+
 static Queue_job* QUEUE_JOB;                   /* Shared resource between the threads, need to handle race conditions using mutexes */
-static volatile int JOBS_PENDING;              /* Shared resource between the threads, need to handle race conditions using mutexes */
+static Queue_job** LOCAL_QUEUES;               /* One queue per worker for jobs submitted with an affinity key, guarded by LOCK_POOL */
+static atomic_int JOBS_PENDING;                /* Jobs submitted and not completed, LOCK_POOL is only taken by the job bringing it to 0 */
 
 static pthread_mutex_t LOCK_POOL;              /* Single lock for the whole pool */
-static pthread_cond_t COND_WORKER;             /* Conditional variable for the workers */
 static pthread_cond_t COND_COMPLETED;          /* Conditional variable for the completion of all jobs */
 
 
 static pthread_t *WORKERS;                     /* Array of threads */
 static int NUMBER_OF_WORKERS;                  /* Number of threads */
+static Worker_slot* WORKER_SLOTS;              /* One conditional variable per worker, so a job wakes a single worker that may take it */
+
+static atomic_int SHUTDOWN_WORKERS;            /* Initially 0, changed to 1 (under LOCK_POOL) to exit the threads */
 
-static volatile int SHUTDOWN_WORKERS;          /* Initially 0, changed to 1 to exit the threads */
+static int REACTOR_EPOLL_FD = -1;              /* epoll instance watching the fds of fd jobs and waiting coroutines */
+static int REACTOR_WAKE_FD = -1;               /* eventfd registered in REACTOR_EPOLL_FD, written to wake the reactor */
+static pthread_t REACTOR;                      /* Thread turning fd readiness into queued jobs */
+static int COROUTINES_PARKED;                  /* Coroutines registered with the reactor, guarded by LOCK_POOL */
+static FdWatch* FD_WATCHES;                    /* Registered fd jobs, guarded by LOCK_POOL */
+static FdWatch* RETIRED_WATCHES;               /* Unregistered fd jobs, freed by the reactor, guarded by LOCK_POOL */
+static atomic_int SHUTDOWN_REACTOR;            /* Initially 0, changed to 1 once all the workers have exited */
+
+static __thread ucontext_t WORKER_CONTEXT;     /* Context a worker switches away from when resuming a coroutine */
+static __thread Job* CURRENT_JOB;              /* Job being executed by this worker */
 
 
 
@@ -54,24 +123,51 @@ static volatile int SHUTDOWN_WORKERS;          /* Initially 0, changed to 1 to e
 // =================================================
 
 static Job* _create_job(void (*func_to_the_job)(void*), void* args);
+static Job* _create_coroutine_job(void (*func_to_the_job)(void*), void* args);
 static void _free_job(Job** job);
 
 static Queue_job* _create_queue();
 static int _add_job_to_queue(Queue_job* queue, Job* job_to_add);
 static Job* _pop_job(Queue_job* queue);
 static void _free_queue(Queue_job** queue);
+static void _free_local_queues(int count);
+static Job* _next_job_for_worker(int worker_idx);
+
+static int _init_worker_slots(int count);
+static void _free_worker_slots(int count);
+static void _wake_worker(int worker_idx);
+static void _wake_idle_worker();
+static void _wake_all_workers();
+
+static void* _worker(void* arg);
+static int _shutdown_requested();
+static int _submit_job(Job* job_to_add);
+static void _requeue_job(Job* job);
 
-static void* _worker();
+static void _coroutine_entry();
+static int _resume_coroutine(Job* job);
+static void _switch_to_worker(Coroutine* coroutine, int state);
+
+static int _start_reactor();
+static void _stop_reactor();
+static void _park_coroutine(Job* job);
+static void _unpark_coroutine(Job* job);
+static void _retire_watch(FdWatch* watch);
+static void _free_retired_watches(int force);
+static void _rearm_watch(FdWatch* watch);
+static void _queue_ready_events(struct epoll_event* events, int count);
+static void* _reactor();
 
 
 
 /**
  * Initialises the thread pool.
- * Returns 0 if error.
+ * Returns 0 if error, including a num_threads which is not positive.
  * 
  * @param num_threads The number of threads (excluding the main thread calling this) to have on standby (and later working).
 */
 int thread_pool_init(int num_threads) {
+    if (num_threads <= 0) {printf("num_threads must be positive\n"); return 0;}
 
     /* Initialise the queue */
     QUEUE_JOB = _create_queue();
@@ -85,60 +181,98 @@ int thread_pool_init(int num_threads) {
         return 0;
     }
 
-    if (pthread_cond_init(&COND_WORKER, NULL) != 0) {
+    if (pthread_cond_init(&COND_COMPLETED, NULL) != 0) {
         printf("Init of COND_POOL failed\n"); 
         _free_queue(&QUEUE_JOB);
         pthread_mutex_destroy(&LOCK_POOL);
         return 0;
     }
 
-    if (pthread_cond_init(&COND_COMPLETED, NULL) != 0) {
-        printf("Init of COND_POOL failed\n"); 
+
+    atomic_store_explicit(&JOBS_PENDING, 0, memory_order_relaxed);
+    atomic_store_explicit(&SHUTDOWN_WORKERS, 0, memory_order_relaxed);
+
+    /* Initialise the per worker queues used by affinity jobs */
+    LOCAL_QUEUES = (Queue_job**) calloc(num_threads, sizeof(Queue_job*));
+    if (!LOCAL_QUEUES) {
+        printf("Malloc for LOCAL_QUEUES failed\n"); 
         _free_queue(&QUEUE_JOB);
-        pthread_cond_destroy(&COND_WORKER);
+        pthread_cond_destroy(&COND_COMPLETED);
         pthread_mutex_destroy(&LOCK_POOL);
         return 0;
     }
 
+    for (int i = 0; i < num_threads; i++) {
+        LOCAL_QUEUES[i] = _create_queue();
+        if (!LOCAL_QUEUES[i]) {
+            printf("Malloc for LOCAL_QUEUES[%d] failed\n", i); 
+            _free_local_queues(i);
+            _free_queue(&QUEUE_JOB);
+            pthread_cond_destroy(&COND_COMPLETED);
+            pthread_mutex_destroy(&LOCK_POOL);
+            return 0;
+        }
+    }
 
-    JOBS_PENDING = 0;
-    SHUTDOWN_WORKERS = 0;
+    /* Initialise the conditional variable each worker sleeps on */
+    if (_init_worker_slots(num_threads) == 0) {
+        printf("Init of WORKER_SLOTS failed\n"); 
+        _free_local_queues(num_threads);
+        _free_queue(&QUEUE_JOB);
+        pthread_cond_destroy(&COND_COMPLETED);
+        pthread_mutex_destroy(&LOCK_POOL);
+        return 0;
+    }
 
     /* Initialise the array of threads/workers */
     WORKERS = (pthread_t*) malloc(sizeof(pthread_t) * num_threads);
     if (!WORKERS) {
         printf("Malloc for WORKERS failed\n"); 
+        _free_local_queues(num_threads);
+        _free_queue(&QUEUE_JOB);
+        pthread_cond_destroy(&COND_COMPLETED);
+        _free_worker_slots(num_threads);
+        pthread_mutex_destroy(&LOCK_POOL);
+        return 0;
+    }
+
+    NUMBER_OF_WORKERS = num_threads;    /* Set before spawning, workers read it when looking for work to steal */
+
+    COROUTINES_PARKED = 0;
+    if (_start_reactor() == 0) {
+        printf("Start of the reactor failed\n"); 
+        free(WORKERS);
+        _free_local_queues(num_threads);
         _free_queue(&QUEUE_JOB);
         pthread_cond_destroy(&COND_COMPLETED);
-        pthread_cond_destroy(&COND_WORKER);
+        _free_worker_slots(num_threads);
         pthread_mutex_destroy(&LOCK_POOL);
         return 0;
     }
    
     /* Create the threads/workers */
     for (int i = 0; i < num_threads; i++) {
-        if (pthread_create(&WORKERS[i], NULL, _worker, NULL) != 0) {
+        if (pthread_create(&WORKERS[i], NULL, _worker, (void*)(intptr_t) i) != 0) {
     
             pthread_mutex_lock(&LOCK_POOL);
-            SHUTDOWN_WORKERS = 1;
+            atomic_store_explicit(&SHUTDOWN_WORKERS, 1, memory_order_release);
+            _wake_all_workers();
             pthread_mutex_unlock(&LOCK_POOL);
-            
-            pthread_cond_broadcast(&COND_WORKER);
 
             for (int j = 0; j < i; j++) {pthread_join(WORKERS[j], NULL);}
+            _stop_reactor();
 
             free(WORKERS);
+            _free_local_queues(num_threads);
             _free_queue(&QUEUE_JOB);
 
             pthread_cond_destroy(&COND_COMPLETED);
-            pthread_cond_destroy(&COND_WORKER);
+            _free_worker_slots(num_threads);
             pthread_mutex_destroy(&LOCK_POOL);
             
             return 0;
         }
     }
-    
-    NUMBER_OF_WORKERS = num_threads; 
 
     return 1;
 }
@@ -146,38 +280,48 @@ int thread_pool_init(int num_threads) {
 
 
 
-static void* _worker() {
+static void* _worker(void* arg) {
+    int worker_idx = (int)(intptr_t) arg;
+
     while (1) {     /* Infinite loop */
 
         pthread_mutex_lock(&LOCK_POOL);
 
         /* This will prevent race conditions and exiting this loop means that this worker has the lock on queue and will work */
-        while (QUEUE_JOB->queue_size == 0 && SHUTDOWN_WORKERS == 0) {
-            pthread_cond_wait(&COND_WORKER, &LOCK_POOL);
+        /* Parked coroutines keep the workers alive during shutdown as they come back to the queue once their fd is ready */
+        Job* job_to_do = NULL;
+        while ((job_to_do = _next_job_for_worker(worker_idx)) == NULL && (!_shutdown_requested() || COROUTINES_PARKED > 0)) {
+            WORKER_SLOTS[worker_idx].idle = 1;
+            pthread_cond_wait(&WORKER_SLOTS[worker_idx].cond, &LOCK_POOL);
         }
+        WORKER_SLOTS[worker_idx].idle = 0;     /* Covers spurious wake ups, nobody cleared it then */
 
-        if (QUEUE_JOB->queue_size == 0 && SHUTDOWN_WORKERS == 1) {     /* True when no more jobs and shutdown is requested */
+        if (!job_to_do && _shutdown_requested()) {     /* True when no more jobs for this worker and shutdown is requested */
             pthread_mutex_unlock(&LOCK_POOL);
             break;
         }
 
-        Job* job_to_do = _pop_job(QUEUE_JOB);
         pthread_mutex_unlock(&LOCK_POOL);
 
 
-        /* Execute the job */
+        /* Execute the job, a coroutine which yielded or waits on an fd is not completed yet */
         if (!job_to_do) continue;
-        job_to_do->func_to_the_job(job_to_do->args);
+        if (job_to_do->coroutine) {
+            if (_resume_coroutine(job_to_do) == 0) continue;
+        } else {
+            job_to_do->func_to_the_job(job_to_do->args);
+            if (job_to_do->watch) _rearm_watch(job_to_do->watch);
+        }
         _free_job(&job_to_do);
 
 
-        pthread_mutex_lock(&LOCK_POOL);
-        JOBS_PENDING--;
-
-        if (JOBS_PENDING == 0) {
-            pthread_cond_signal(&COND_COMPLETED);
+        /* acq_rel so the job's writes are visible to the thread returning from thread_pool_wait */
+        if (atomic_fetch_sub_explicit(&JOBS_PENDING, 1, memory_order_acq_rel) == 1) {
+            /* The lock is taken so a waiter between its check and its sleep cannot miss the broadcast */
+            pthread_mutex_lock(&LOCK_POOL);
+            pthread_cond_broadcast(&COND_COMPLETED);
+            pthread_mutex_unlock(&LOCK_POOL);
         }
-        pthread_mutex_unlock(&LOCK_POOL);
 
     }
     return NULL;
@@ -185,6 +329,15 @@ static void* _worker() {
 
 
 
+/**
+ * Returns 1 once thread_pool_cleanup has asked the workers to exit.
+*/
+static int _shutdown_requested() {
+    return atomic_load_explicit(&SHUTDOWN_WORKERS, memory_order_acquire) == 1;
+}
+
+
+
 /**
  * Adds task to be completed by the thread workers.
  * Will be executed when a thread worker is free. Execution order is currently FIFO.
@@ -201,6 +354,39 @@ int thread_pool_add_job(void (*func_ptr_to_task)(void*), void* args) {
         return 0;
     }
 
+    return _submit_job(job_to_add);
+}
+
+
+
+/**
+ * Adds a task which runs as a coroutine on its own stack.
+ * Inside it thread_pool_yield and thread_pool_wait_fd give the worker back to the pool, which runs other jobs until the coroutine is resumed.
+ * The coroutine may be resumed by a different worker than the one it yielded on.
+ * Returns 0 on error.
+ * 
+ * @param func_ptr_to_task The function pointer to the task to be done. Argument to the function must be a void* pointer and return type void.
+ * @param args The arguments to the function pointer, must be a void* pointer.
+*/
+int thread_pool_add_coroutine_job(void (*func_ptr_to_task)(void*), void* args) {
+
+    Job* job_to_add = _create_coroutine_job(func_ptr_to_task, args);
+    if (!job_to_add) {
+        printf("Coroutine job could not be alloced\n"); 
+        return 0;
+    }
+
+    return _submit_job(job_to_add);
+}
+
+
+
+/**
+ * Pushes a newly created job to the shared queue and accounts for it in JOBS_PENDING.
+ * Returns 0 on error.
+*/
+static int _submit_job(Job* job_to_add) {
+
     if (pthread_mutex_lock(&LOCK_POOL) != 0) {printf("Error in acquistion of LOCK_QUEUE_JOB\n"); return 0;}
 
     if (_add_job_to_queue(QUEUE_JOB, job_to_add) == 0) {
@@ -210,9 +396,61 @@ int thread_pool_add_job(void (*func_ptr_to_task)(void*), void* args) {
         return 0;
     }
 
-    JOBS_PENDING++;
+    atomic_fetch_add_explicit(&JOBS_PENDING, 1, memory_order_relaxed);     /* Ordered by LOCK_POOL, workers pop under it */
+
+    _wake_idle_worker();
+    if (pthread_mutex_unlock(&LOCK_POOL) != 0) {printf("Error in releasing of LOCK_QUEUE_JOB\n"); return 0;}
+
+    return 1;
+}
+
+
+
+/**
+ * Pushes a job which is already accounted for in JOBS_PENDING (a resumed coroutine) back to the shared queue.
+*/
+static void _requeue_job(Job* job) {
+    pthread_mutex_lock(&LOCK_POOL);
+    _add_job_to_queue(QUEUE_JOB, job);
+    _wake_idle_worker();
+    pthread_mutex_unlock(&LOCK_POOL);
+}
+
+
+
+/**
+ * Adds task to be completed preferably by the worker selected by the key (key % number of workers).
+ * Jobs sharing a key run on the same worker, in FIFO order, so state it touched stays warm in that worker's cache.
+ * If that worker falls behind by more than AFFINITY_STEAL_THRESHOLD jobs, idle workers may take its oldest jobs.
+ * Returns 0 on error.
+ * 
+ * @param func_ptr_to_task The function pointer to the task to be done. Argument to the function must be a void* pointer and return type void.
+ * @param args The arguments to the function pointer, must be a void* pointer.
+ * @param key The affinity key (a worker index or any value identifying the state the job works on, e.g. a connection id).
+*/
+int thread_pool_add_job_affinity(void (*func_ptr_to_task)(void*), void* args, unsigned long key) {
+
+    Job* job_to_add = _create_job(func_ptr_to_task, args);
+    if (!job_to_add) {
+        printf("Job struct could not be alloced\n"); 
+        return 0;
+    }
+
+    if (pthread_mutex_lock(&LOCK_POOL) != 0) {printf("Error in acquistion of LOCK_QUEUE_JOB\n"); return 0;}
+
+    int worker_idx = (int)(key % NUMBER_OF_WORKERS);
+    if (_add_job_to_queue(LOCAL_QUEUES[worker_idx], job_to_add) == 0) {
+        printf("Job could not be added\n"); 
+        _free_job(&job_to_add);
+        pthread_mutex_unlock(&LOCK_POOL);
+        return 0;
+    }
+
+    atomic_fetch_add_explicit(&JOBS_PENDING, 1, memory_order_relaxed);     /* Ordered by LOCK_POOL, workers pop under it */
 
-    if (pthread_cond_signal(&COND_WORKER) != 0) {printf("Error in signaling of COND_QUEUE_JOB\n"); return 0;}
+    /* Only the owner may take the job, until its queue is long enough for the idle workers to steal from it */
+    if (LOCAL_QUEUES[worker_idx]->queue_size > AFFINITY_STEAL_THRESHOLD) _wake_all_workers();
+    else _wake_worker(worker_idx);
     if (pthread_mutex_unlock(&LOCK_POOL) != 0) {printf("Error in releasing of LOCK_QUEUE_JOB\n"); return 0;}
 
     return 1;
@@ -224,9 +462,11 @@ int thread_pool_add_job(void (*func_ptr_to_task)(void*), void* args) {
  * Wait untill all the jobs given to the thread pool are completed (all the workers will be free after the completion of this call).
 */
 void thread_pool_wait() {
+    if (atomic_load_explicit(&JOBS_PENDING, memory_order_acquire) == 0) return;
+
     pthread_mutex_lock(&LOCK_POOL);
     
-    while (JOBS_PENDING > 0) {
+    while (atomic_load_explicit(&JOBS_PENDING, memory_order_acquire) > 0) {
         pthread_cond_wait(&COND_COMPLETED, &LOCK_POOL);
     }
 
@@ -240,25 +480,437 @@ void thread_pool_wait() {
 */
 void thread_pool_cleanup() {
     pthread_mutex_lock(&LOCK_POOL);
-    SHUTDOWN_WORKERS = 1;
+    atomic_store_explicit(&SHUTDOWN_WORKERS, 1, memory_order_release);
+    _wake_all_workers();
     pthread_mutex_unlock(&LOCK_POOL);
 
-    pthread_cond_broadcast(&COND_WORKER);
-
     for (int i = 0; i < NUMBER_OF_WORKERS; i++) {
         pthread_join(WORKERS[i], NULL);
     }
+    _stop_reactor();
     free(WORKERS);
+    _free_local_queues(NUMBER_OF_WORKERS);
 
     pthread_mutex_destroy(&LOCK_POOL);
     pthread_cond_destroy(&COND_COMPLETED);
-    pthread_cond_destroy(&COND_WORKER);
+    _free_worker_slots(NUMBER_OF_WORKERS);
 
     _free_queue(&QUEUE_JOB);
 }
 
 
 
+/**
+ * Gives the worker back to the pool from inside a coroutine job, the coroutine is resumed after the jobs queued before it.
+ * Does nothing when called from a plain job.
+*/
+void thread_pool_yield() {
+    Job* job = CURRENT_JOB;
+    if (!job || !job->coroutine) return;
+
+    _switch_to_worker(job->coroutine, COROUTINE_YIELDED);
+}
+
+
+
+/**
+ * Waits until the fd is ready for the given epoll events (e.g. EPOLLIN).
+ * Inside a coroutine job the worker runs other jobs meanwhile, in a plain job the worker blocks in poll.
+ * Only one coroutine may wait on a given fd at a time.
+ * Returns the ready events, or -1 on error.
+ * 
+ * @param fd The file descriptor to wait on.
+ * @param events The epoll events to wait for.
+*/
+int thread_pool_wait_fd(int fd, unsigned int events) {
+    Job* job = CURRENT_JOB;
+
+    if (!job || !job->coroutine) {
+        struct pollfd pfd = {.fd = fd, .events = (short) events, .revents = 0};
+        if (poll(&pfd, 1, -1) < 0) {perror("poll"); return -1;}
+        return pfd.revents;
+    }
+
+    Coroutine* coroutine = job->coroutine;
+    coroutine->watch.fd = fd;
+    coroutine->watch.events = events;
+    coroutine->ready_events = 0;
+
+    _switch_to_worker(coroutine, COROUTINE_WAITING_FD);
+
+    if (coroutine->ready_events == 0) return -1;    /* The reactor could not watch the fd */
+    return (int) coroutine->ready_events;
+}
+
+
+
+/**
+ * Registers a job to be queued whenever the fd becomes ready for the given epoll events (e.g. EPOLLIN).
+ * A one-shot registration is dropped after its first job, a persistent one is re-armed each time its job returns,
+ * so at most one job per fd is queued or running at a time.
+ * Only one registration per fd is allowed.
+ * Returns 0 on error.
+ * 
+ * @param fd The file descriptor to watch.
+ * @param events The epoll events to wait for.
+ * @param func_ptr_to_task The function pointer to the task to be done. Argument to the function must be a void* pointer and return type void.
+ * @param args The arguments to the function pointer, must be a void* pointer.
+ * @param mode THREAD_POOL_FD_ONESHOT or THREAD_POOL_FD_PERSISTENT.
+*/
+int thread_pool_add_fd_job(int fd, unsigned int events, void (*func_ptr_to_task)(void*), void* args, int mode) {
+    if (!func_ptr_to_task) {printf("func_ptr_to_task is NULL\n"); return 0;}
+
+    FdWatch* watch = (FdWatch*) calloc(1, sizeof(FdWatch));
+    if (!watch) {printf("Malloc for FdWatch failed\n"); return 0;}
+
+    watch->fd = fd;
+    watch->events = events;
+    watch->persistent = (mode == THREAD_POOL_FD_PERSISTENT);
+    watch->func_to_the_job = func_ptr_to_task;
+    watch->args = args;
+
+    pthread_mutex_lock(&LOCK_POOL);
+
+    /* Armed one-shot in both modes, persistent watches are re-armed by the worker once their job is done */
+    struct epoll_event event = {.events = events | EPOLLONESHOT, .data.ptr = watch};
+    if (epoll_ctl(REACTOR_EPOLL_FD, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl add");
+        pthread_mutex_unlock(&LOCK_POOL);
+        free(watch);
+        return 0;
+    }
+
+    watch->next = FD_WATCHES;
+    FD_WATCHES = watch;
+
+    pthread_mutex_unlock(&LOCK_POOL);
+    return 1;
+}
+
+
+
+/**
+ * Unregisters the fd job of the fd, a job already queued for it still runs.
+ * Returns 0 if the fd has no registration.
+ * 
+ * @param fd The file descriptor passed to thread_pool_add_fd_job.
+*/
+int thread_pool_remove_fd_job(int fd) {
+    pthread_mutex_lock(&LOCK_POOL);
+
+    FdWatch* watch = FD_WATCHES;
+    while (watch && watch->fd != fd) watch = watch->next;
+
+    if (watch) _retire_watch(watch);
+
+    pthread_mutex_unlock(&LOCK_POOL);
+    return watch != NULL;
+}
+
+
+
+// =================================================
+//               Coroutine Functions
+// =================================================
+
+/**
+ * First function run on a coroutine's stack, executes the job and switches back for good.
+*/
+static void _coroutine_entry() {
+    Job* job = CURRENT_JOB;     /* Read before the job can migrate to another worker */
+    job->func_to_the_job(job->args);
+    _switch_to_worker(job->coroutine, COROUTINE_FINISHED);
+}
+
+
+
+/**
+ * Saves the coroutine and switches back to the worker which resumed it.
+ * Returns when a worker resumes the coroutine again.
+ * 
+ * @param coroutine The running coroutine
+ * @param state Why the coroutine stops running (COROUTINE_YIELDED, COROUTINE_WAITING_FD or COROUTINE_FINISHED)
+*/
+static void _switch_to_worker(Coroutine* coroutine, int state) {
+    coroutine->state = state;
+    swapcontext(&coroutine->context, coroutine->worker_context);
+}
+
+
+
+/**
+ * Runs a coroutine job on the calling worker until it finishes or gives the worker back.
+ * Yielded coroutines are queued again and waiting ones are handed to the reactor, which happens only after 
+ * the switch back so no other worker can resume the coroutine while its stack is still in use.
+ * Returns 1 if the coroutine finished, 0 if it will be resumed later.
+ * 
+ * @param job The coroutine job to run
+*/
+static int _resume_coroutine(Job* job) {
+    Coroutine* coroutine = job->coroutine;
+
+    CURRENT_JOB = job;
+    coroutine->worker_context = &WORKER_CONTEXT;
+    coroutine->state = COROUTINE_RUNNING;
+    swapcontext(&WORKER_CONTEXT, &coroutine->context);
+    CURRENT_JOB = NULL;
+
+    switch (coroutine->state) {
+        case COROUTINE_YIELDED:
+            _requeue_job(job);
+            return 0;
+        case COROUTINE_WAITING_FD:
+            _park_coroutine(job);
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+
+
+// =================================================
+//                Reactor Functions
+// =================================================
+
+/**
+ * Creates the epoll instance, its wake up eventfd and the reactor thread.
+ * Returns 0 if error.
+*/
+static int _start_reactor() {
+    atomic_store_explicit(&SHUTDOWN_REACTOR, 0, memory_order_relaxed);
+    FD_WATCHES = NULL;
+    RETIRED_WATCHES = NULL;
+
+    REACTOR_EPOLL_FD = epoll_create1(EPOLL_CLOEXEC);
+    if (REACTOR_EPOLL_FD == -1) {perror("epoll_create1"); return 0;}
+
+    REACTOR_WAKE_FD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (REACTOR_WAKE_FD == -1) {
+        perror("eventfd");
+        close(REACTOR_EPOLL_FD);
+        REACTOR_EPOLL_FD = -1;
+        return 0;
+    }
+
+    /* A NULL data pointer identifies the wake up eventfd */
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(REACTOR_EPOLL_FD, EPOLL_CTL_ADD, REACTOR_WAKE_FD, &event) == -1 ||
+        pthread_create(&REACTOR, NULL, _reactor, NULL) != 0) {
+        close(REACTOR_WAKE_FD);
+        close(REACTOR_EPOLL_FD);
+        REACTOR_WAKE_FD = -1;
+        REACTOR_EPOLL_FD = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/**
+ * Stops and joins the reactor thread and drops the fd jobs still registered, must be called after the workers have exited.
+*/
+static void _stop_reactor() {
+    uint64_t wake = 1;
+
+    atomic_store_explicit(&SHUTDOWN_REACTOR, 1, memory_order_release);
+    if (write(REACTOR_WAKE_FD, &wake, sizeof(wake)) != sizeof(wake)) perror("eventfd write");
+    pthread_join(REACTOR, NULL);
+
+    while (FD_WATCHES) _retire_watch(FD_WATCHES);
+    _free_retired_watches(1);
+
+    close(REACTOR_WAKE_FD);
+    close(REACTOR_EPOLL_FD);
+    REACTOR_WAKE_FD = -1;
+    REACTOR_EPOLL_FD = -1;
+}
+
+
+
+/**
+ * Registers a coroutine waiting on an fd with the reactor.
+ * If the fd cannot be watched the coroutine is queued again straight away with no ready events.
+ * 
+ * @param job The coroutine job which switched out with COROUTINE_WAITING_FD
+*/
+static void _park_coroutine(Job* job) {
+    FdWatch* watch = &job->coroutine->watch;
+
+    pthread_mutex_lock(&LOCK_POOL);
+    COROUTINES_PARKED++;
+    pthread_mutex_unlock(&LOCK_POOL);
+
+    struct epoll_event event = {.events = watch->events | EPOLLONESHOT, .data.ptr = watch};
+    if (epoll_ctl(REACTOR_EPOLL_FD, EPOLL_CTL_ADD, watch->fd, &event) == 0) return;
+
+    perror("epoll_ctl add");
+    _unpark_coroutine(job);
+}
+
+
+
+/**
+ * Queues a coroutine which could not be parked again.
+ * 
+ * @param job The coroutine job
+*/
+static void _unpark_coroutine(Job* job) {
+    pthread_mutex_lock(&LOCK_POOL);
+    COROUTINES_PARKED--;
+    _add_job_to_queue(QUEUE_JOB, job);
+
+    if (_shutdown_requested() && COROUTINES_PARKED == 0) _wake_all_workers();
+    else _wake_idle_worker();
+    pthread_mutex_unlock(&LOCK_POOL);
+}
+
+
+
+/**
+ * Unregisters an fd job and hands it to the reactor to be freed, must be called with LOCK_POOL held.
+ * The reactor may still hold a readiness event for it from its last epoll_wait, hence the deferred free.
+*/
+static void _retire_watch(FdWatch* watch) {
+    FdWatch** link = &FD_WATCHES;
+    while (*link && *link != watch) link = &(*link)->next;
+    if (*link) *link = watch->next;
+
+    epoll_ctl(REACTOR_EPOLL_FD, EPOLL_CTL_DEL, watch->fd, NULL);
+    watch->removed = 1;
+    watch->next = RETIRED_WATCHES;
+    RETIRED_WATCHES = watch;
+}
+
+
+
+/**
+ * Frees the retired fd jobs which have no job queued or running, or all of them if force is set.
+*/
+static void _free_retired_watches(int force) {
+    pthread_mutex_lock(&LOCK_POOL);
+
+    FdWatch** link = &RETIRED_WATCHES;
+    while (*link) {
+        FdWatch* watch = *link;
+        if (force || !watch->in_flight) {
+            *link = watch->next;
+            free(watch);
+        } else {
+            link = &watch->next;
+        }
+    }
+
+    pthread_mutex_unlock(&LOCK_POOL);
+}
+
+
+
+/**
+ * Arms a persistent fd job again once its job has returned.
+*/
+static void _rearm_watch(FdWatch* watch) {
+    pthread_mutex_lock(&LOCK_POOL);
+    watch->in_flight = 0;
+
+    if (!watch->removed) {
+        struct epoll_event event = {.events = watch->events | EPOLLONESHOT, .data.ptr = watch};
+        if (epoll_ctl(REACTOR_EPOLL_FD, EPOLL_CTL_MOD, watch->fd, &event) == -1) {
+            perror("epoll_ctl mod");
+            _retire_watch(watch);
+        }
+    }
+    pthread_mutex_unlock(&LOCK_POOL);
+}
+
+
+
+/**
+ * Turns a batch of readiness events into queued jobs under a single acquisition of LOCK_POOL.
+ * Waiting coroutines are resumed, fd jobs get a new job (one-shot ones are unregistered at the same time).
+ * 
+ * @param events The events returned by epoll_wait, the wake up eventfd already filtered out
+ * @param count The number of events
+*/
+static void _queue_ready_events(struct epoll_event* events, int count) {
+    int queued = 0;
+
+    pthread_mutex_lock(&LOCK_POOL);
+
+    for (int i = 0; i < count; i++) {
+        FdWatch* watch = (FdWatch*) events[i].data.ptr;
+
+        if (watch->coroutine_job) {
+            epoll_ctl(REACTOR_EPOLL_FD, EPOLL_CTL_DEL, watch->fd, NULL);    /* Lets the fd be waited on again */
+            watch->coroutine_job->coroutine->ready_events = events[i].events;
+
+            COROUTINES_PARKED--;
+            _add_job_to_queue(QUEUE_JOB, watch->coroutine_job);
+            queued++;
+            continue;
+        }
+
+        if (watch->removed) continue;   /* Unregistered after epoll_wait returned */
+
+        Job* job = _create_job(watch->func_to_the_job, watch->args);
+        if (!job) {
+            printf("Job struct for fd %d could not be alloced\n", watch->fd);
+            _retire_watch(watch);
+            continue;
+        }
+
+        if (watch->persistent) {
+            job->watch = watch;
+            watch->in_flight = 1;
+        } else {
+            _retire_watch(watch);
+        }
+
+        _add_job_to_queue(QUEUE_JOB, job);
+        atomic_fetch_add_explicit(&JOBS_PENDING, 1, memory_order_relaxed);     /* Ordered by LOCK_POOL, workers pop under it */
+        queued++;
+    }
+
+    if (_shutdown_requested() && COROUTINES_PARKED == 0) _wake_all_workers();
+    else for (int i = 0; i < queued; i++) _wake_idle_worker();
+
+    pthread_mutex_unlock(&LOCK_POOL);
+}
+
+
+
+/**
+ * Reactor thread, blocks on the epoll instance until fds become ready or the eventfd is written.
+*/
+static void* _reactor() {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (atomic_load_explicit(&SHUTDOWN_REACTOR, memory_order_acquire) == 0) {
+        _free_retired_watches(0);
+
+        int ready = epoll_wait(REACTOR_EPOLL_FD, events, REACTOR_MAX_EVENTS, -1);
+        if (ready < 0) continue;    /* EINTR */
+
+        /* Drop the wake up event, the loop condition handles it */
+        int count = 0;
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr == NULL) {
+                uint64_t wakes;
+                if (read(REACTOR_WAKE_FD, &wakes, sizeof(wakes)) == -1) {}  /* Nothing to do if already drained */
+                continue;
+            }
+            events[count++] = events[i];
+        }
+
+        if (count > 0) _queue_ready_events(events, count);
+    }
+    return NULL;
+}
+
+
+
 // =================================================
 //                 Queue Functions
 // =================================================
@@ -281,6 +933,8 @@ static Job* _create_job(void (*func_to_the_job)(void*), void* args) {
 
     new_job->func_to_the_job = func_to_the_job;
     new_job->args = args;
+    new_job->coroutine = NULL;
+    new_job->watch = NULL;
     new_job->next = NULL;
 
     return new_job;
@@ -288,11 +942,58 @@ static Job* _create_job(void (*func_to_the_job)(void*), void* args) {
 
 
 
+/**
+ * Creates a job object which runs as a coroutine on its own stack.
+ * Returns NULL if any error.
+ * 
+ * @param func_to_the_job The function pointer of the job
+ * @param args Void* pointer to struct in which the func_to_the_job operates
+ */
+static Job* _create_coroutine_job(void (*func_to_the_job)(void*), void* args) {
+    Job* new_job = _create_job(func_to_the_job, args);
+    if (!new_job) return NULL;
+
+    Coroutine* coroutine = (Coroutine*) malloc(sizeof(Coroutine));
+    if (!coroutine) {printf("Malloc for coroutine failed\n"); _free_job(&new_job); return NULL;}
+
+    coroutine->stack = malloc(COROUTINE_STACK_SIZE);
+    if (!coroutine->stack) {printf("Malloc for coroutine stack failed\n"); free(coroutine); _free_job(&new_job); return NULL;}
+
+    if (getcontext(&coroutine->context) == -1) {
+        perror("getcontext");
+        free(coroutine->stack);
+        free(coroutine);
+        _free_job(&new_job);
+        return NULL;
+    }
+
+    coroutine->context.uc_stack.ss_sp = coroutine->stack;
+    coroutine->context.uc_stack.ss_size = COROUTINE_STACK_SIZE;
+    coroutine->context.uc_link = NULL;      /* The entry never returns, it switches back to whichever worker runs it */
+    makecontext(&coroutine->context, _coroutine_entry, 0);
+
+    coroutine->worker_context = NULL;
+    coroutine->state = COROUTINE_RUNNING;
+    memset(&coroutine->watch, 0, sizeof(FdWatch));
+    coroutine->watch.fd = -1;
+    coroutine->watch.coroutine_job = new_job;
+    coroutine->ready_events = 0;
+
+    new_job->coroutine = coroutine;
+    return new_job;
+}
+
+
+
 /**
  * Completely frees a job.
  */
 static void _free_job(Job** job) {
     if (job && *job) {
+        if ((*job)->coroutine) {
+            free((*job)->coroutine->stack);
+            free((*job)->coroutine);
+        }
         free(*job);
         *job = NULL;
     }
@@ -374,6 +1075,107 @@ static Job* _pop_job(Queue_job* queue) {
 
 
 
+/**
+ * Returns the next job the given worker should execute, must be called with LOCK_POOL held.
+ * Order of preference: the worker's own affinity queue, the shared queue, then the oldest job of the most
+ * backed up affinity queue if it is longer than AFFINITY_STEAL_THRESHOLD.
+ * Returns NULL if there is no job this worker may take.
+ * 
+ * @param worker_idx The index of the worker asking for a job
+*/
+static Job* _next_job_for_worker(int worker_idx) {
+    if (LOCAL_QUEUES[worker_idx]->queue_size != 0) return _pop_job(LOCAL_QUEUES[worker_idx]);
+    if (QUEUE_JOB->queue_size != 0) return _pop_job(QUEUE_JOB);
+
+    int victim_idx = -1;
+    for (int i = 0; i < NUMBER_OF_WORKERS; i++) {
+        if (LOCAL_QUEUES[i]->queue_size > AFFINITY_STEAL_THRESHOLD && 
+            (victim_idx == -1 || LOCAL_QUEUES[i]->queue_size > LOCAL_QUEUES[victim_idx]->queue_size)) {
+            victim_idx = i;
+        }
+    }
+
+    if (victim_idx == -1) return NULL;
+    return _pop_job(LOCAL_QUEUES[victim_idx]);
+}
+
+
+
+/**
+ * Frees the first count per worker queues and the array holding them.
+*/
+static void _free_local_queues(int count) {
+    if (!LOCAL_QUEUES) return;
+    for (int i = 0; i < count; i++) _free_queue(&LOCAL_QUEUES[i]);
+    free(LOCAL_QUEUES);
+    LOCAL_QUEUES = NULL;
+}
+
+
+
+/**
+ * Allocates WORKER_SLOTS and initialises the conditional variable of each of the count workers.
+ * Returns 0 on error.
+*/
+static int _init_worker_slots(int count) {
+    WORKER_SLOTS = (Worker_slot*) calloc(count, sizeof(Worker_slot));
+    if (!WORKER_SLOTS) return 0;
+
+    for (int i = 0; i < count; i++) {
+        if (pthread_cond_init(&WORKER_SLOTS[i].cond, NULL) != 0) {
+            _free_worker_slots(i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+
+/**
+ * Destroys the conditional variables of the first count workers and frees WORKER_SLOTS.
+*/
+static void _free_worker_slots(int count) {
+    if (!WORKER_SLOTS) return;
+    for (int i = 0; i < count; i++) pthread_cond_destroy(&WORKER_SLOTS[i].cond);
+    free(WORKER_SLOTS);
+    WORKER_SLOTS = NULL;
+}
+
+
+
+/**
+ * Wakes the given worker if it sleeps, must be called with LOCK_POOL held.
+ * A busy worker looks at the queues again before sleeping, so it needs no signal.
+*/
+static void _wake_worker(int worker_idx) {
+    if (!WORKER_SLOTS[worker_idx].idle) return;
+    WORKER_SLOTS[worker_idx].idle = 0;     /* Cleared here so the next job wakes another worker */
+    pthread_cond_signal(&WORKER_SLOTS[worker_idx].cond);
+}
+
+
+
+/**
+ * Wakes one sleeping worker for a job of the shared queue, must be called with LOCK_POOL held.
+*/
+static void _wake_idle_worker() {
+    for (int i = 0; i < NUMBER_OF_WORKERS; i++) {
+        if (WORKER_SLOTS[i].idle) {_wake_worker(i); return;}
+    }
+}
+
+
+
+/**
+ * Wakes every sleeping worker, must be called with LOCK_POOL held.
+*/
+static void _wake_all_workers() {
+    for (int i = 0; i < NUMBER_OF_WORKERS; i++) _wake_worker(i);
+}
+
+
+
 /**
  * Completely frees a queue.
 */